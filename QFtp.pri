@@ -1,14 +1,35 @@
-QT += network
+QT += network concurrent
 
 INCLUDEPATH += $$PWD
 
 HEADERS += \
+    $$PWD/ftpdirentry.h \
+    $$PWD/ftpdirsnapshot.h \
+    $$PWD/ftpdirwatcher.h \
+    $$PWD/ftplistingstore.h \
+    $$PWD/ftplistsorter.h \
     $$PWD/ftpmodel.h \
+    $$PWD/ftpnameindex.h \
+    $$PWD/ftpprefetcher.h \
+    $$PWD/ftpremotefile.h \
+    $$PWD/ftpsyncengine.h \
+    $$PWD/ftptreewalker.h \
     $$PWD/qftp.h \
+    $$PWD/qftplinescan_p.h \
     $$PWD/qurlinfo.h
 
 SOURCES += \
+    $$PWD/ftpdirentry.cpp \
+    $$PWD/ftpdirsnapshot.cpp \
+    $$PWD/ftpdirwatcher.cpp \
+    $$PWD/ftplistingstore.cpp \
+    $$PWD/ftplistsorter.cpp \
     $$PWD/ftpmodel.cpp \
+    $$PWD/ftpnameindex.cpp \
+    $$PWD/ftpprefetcher.cpp \
+    $$PWD/ftpremotefile.cpp \
+    $$PWD/ftpsyncengine.cpp \
+    $$PWD/ftptreewalker.cpp \
     $$PWD/qftp.cpp \
     $$PWD/qurlinfo.cpp
 
@@ -0,0 +1,7 @@
+QT = core testlib
+CONFIG += console release
+TARGET = tst_bench_listing
+
+INCLUDEPATH += $$PWD/../..
+HEADERS += $$PWD/../../qftplinescan_p.h
+SOURCES += tst_bench_listing.cpp
@@ -0,0 +1,94 @@
+// Кадрирование строк синтетического листинга: прежний путь через
+// canReadLine()/readLine() с копией каждой строки и нынешний поиск '\n'
+// по одному буферу (_q_findNewline(), SSE2/AVX2 по флагам сборки).
+// Размер листинга - QFTP_BENCH_MB мегабайт, по умолчанию 500.
+//
+//   qmake && make && ./tst_bench_listing
+
+#include <QBuffer>
+#include <QtTest>
+#include <qftplinescan_p.h>
+
+class tst_BenchListing : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void readLine();
+    void scalarScan();
+    void findNewline();
+
+private:
+    QByteArray _listing;
+    int _lines = 0;
+};
+
+void tst_BenchListing::initTestCase()
+{
+    const qint64 megabytes = qEnvironmentVariableIsSet("QFTP_BENCH_MB")
+            ? qEnvironmentVariableIntValue("QFTP_BENCH_MB") : 500;
+    const qint64 size = megabytes * 1024 * 1024;
+    _listing.reserve(int(qMin<qint64>(size + 256, std::numeric_limits<int>::max())));
+    while (_listing.size() < size) {
+        // Обычная строка UNIX-листинга, около 80 байт.
+        _listing += "-rw-r--r--   1 ftpuser  ftpgroup   ";
+        _listing += QByteArray::number(1000 + _lines % 900000).rightJustified(10, ' ');
+        _listing += " Jan 01 12:00 file_";
+        _listing += QByteArray::number(_lines).rightJustified(8, '0');
+        _listing += ".dat\r\n";
+        ++_lines;
+    }
+}
+
+void tst_BenchListing::readLine()
+{
+    int lines = 0;
+    QBENCHMARK_ONCE {
+        QBuffer buffer(&_listing);
+        buffer.open(QIODevice::ReadOnly);
+        while (buffer.canReadLine()) {
+            const QByteArray line = buffer.readLine();
+            lines += line.isEmpty() ? 0 : 1;
+        }
+    }
+    QCOMPARE(lines, _lines);
+}
+
+void tst_BenchListing::scalarScan()
+{
+    int lines = 0;
+    QBENCHMARK_ONCE {
+        const char *pos = _listing.constData();
+        const char *end = pos + _listing.size();
+        while (pos < end) {
+            const char *next = pos;
+            while (next < end && *next != '\n')
+                ++next;
+            const QByteArray line = QByteArray::fromRawData(pos, int(next - pos));
+            lines += line.isEmpty() ? 0 : 1;
+            pos = next + 1;
+        }
+    }
+    QCOMPARE(lines, _lines);
+}
+
+void tst_BenchListing::findNewline()
+{
+    int lines = 0;
+    QBENCHMARK_ONCE {
+        const char *pos = _listing.constData();
+        const char *end = pos + _listing.size();
+        while (pos < end) {
+            const char *next = _q_findNewline(pos, end);
+            const QByteArray line = QByteArray::fromRawData(pos, int(next - pos));
+            lines += line.isEmpty() ? 0 : 1;
+            pos = next + 1;
+        }
+    }
+    QCOMPARE(lines, _lines);
+}
+
+QTEST_APPLESS_MAIN(tst_BenchListing)
+
+#include "tst_bench_listing.moc"
@@ -0,0 +1,74 @@
+#include "ftpdirentry.h"
+
+FtpDirEntry::FtpDirEntry(const QUrlInfo &info)
+{
+    if (!info.isValid()) {
+        return;
+    }
+    _name = info.name();
+    _owner = info.owner();
+    _group = info.group();
+    _size = info.size();
+    setLastModified(info.lastModified());
+    _permissions = quint16(info.permissions());
+    _flags = Valid;
+    setFlag(Dir, info.isDir());
+    setFlag(File, info.isFile());
+    setFlag(SymLink, info.isSymLink());
+    setFlag(Writable, info.isWritable());
+    setFlag(Readable, info.isReadable());
+    setFlag(Executable, info.isExecutable());
+}
+
+QUrlInfo FtpDirEntry::toUrlInfo() const
+{
+    if (!isValid()) {
+        return QUrlInfo();
+    }
+    // lastRead FTP не заполняет.
+    return QUrlInfo(_name, _permissions, _owner, _group, _size, lastModified(), QDateTime(),
+                    isDir(), isFile(), isSymLink(), isWritable(), isReadable(), isExecutable());
+}
+
+QDateTime FtpDirEntry::lastModified() const
+{
+    if (_mtime == NoTime) {
+        return QDateTime();
+    }
+    return QDateTime::fromSecsSinceEpoch(_mtime);
+}
+
+void FtpDirEntry::setLastModified(const QDateTime &dt)
+{
+    makeValid();
+    _mtime = dt.isValid() ? dt.toSecsSinceEpoch() : NoTime;
+}
+
+void FtpDirEntry::setFlag(Flag flag, bool on)
+{
+    makeValid();
+    if (on) {
+        _flags |= flag;
+    } else {
+        _flags &= ~flag;
+    }
+}
+
+bool FtpDirEntry::operator==(const FtpDirEntry &other) const
+{
+    return _flags == other._flags
+            && _size == other._size
+            && _mtime == other._mtime
+            && _permissions == other._permissions
+            && _name == other._name
+            && _owner == other._owner
+            && _group == other._group;
+}
+
+void FtpDirEntry::makeValid()
+{
+    // Те же значения по умолчанию, что у QUrlInfoPrivate.
+    if (!(_flags & Valid)) {
+        _flags = Valid | File | Writable | Readable;
+    }
+}
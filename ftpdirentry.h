@@ -0,0 +1,89 @@
+#pragma once
+
+#include <limits>
+#include <QDateTime>
+#include <QMetaType>
+#include <QString>
+#include <qurlinfo.h>
+
+// Компактная запись листинга каталога.
+// В отличие от QUrlInfo не имеет vtable и отдельной кучи под данные:
+// три строки (владелец и группа обычно общие на весь листинг),
+// размер, время изменения в секундах от эпохи и упакованные флаги.
+class FtpDirEntry
+{
+public:
+    enum Flag : quint8 {
+        Valid       = 0x01,
+        Dir         = 0x02,
+        File        = 0x04,
+        SymLink     = 0x08,
+        Writable    = 0x10,
+        Readable    = 0x20,
+        Executable  = 0x40,
+        // В листинге была только дата, без времени (файлы старше
+        // полугода в формате Unix): время известно с точностью до суток.
+        DateOnly    = 0x80
+    };
+
+    // Значение lastModifiedSecs(), если время неизвестно.
+    static constexpr qint64 NoTime = std::numeric_limits<qint64>::min();
+
+    FtpDirEntry() = default;
+    explicit FtpDirEntry(const QUrlInfo &info);
+
+    QUrlInfo toUrlInfo() const;
+
+    bool isValid() const { return _flags & Valid; }
+
+    const QString &name() const { return _name; }
+    const QString &owner() const { return _owner; }
+    const QString &group() const { return _group; }
+    qint64 size() const { return _size; }
+    qint64 lastModifiedSecs() const { return _mtime; }
+    QDateTime lastModified() const;
+    int permissions() const { return _permissions; }
+    quint8 flags() const { return _flags; }
+
+    bool isDir() const { return _flags & Dir; }
+    bool isFile() const { return _flags & File; }
+    bool isSymLink() const { return _flags & SymLink; }
+    bool isWritable() const { return _flags & Writable; }
+    bool isReadable() const { return _flags & Readable; }
+    bool isExecutable() const { return _flags & Executable; }
+    bool isDateOnly() const { return _flags & DateOnly; }
+
+    // Как и у QUrlInfo, любой сеттер делает запись валидной.
+    void setName(const QString &name) { makeValid(); _name = name; }
+    void setOwner(const QString &owner) { makeValid(); _owner = owner; }
+    void setGroup(const QString &group) { makeValid(); _group = group; }
+    void setSize(qint64 size) { makeValid(); _size = size; }
+    void setLastModified(const QDateTime &dt);
+    void setLastModifiedSecs(qint64 secs) { makeValid(); _mtime = secs; }
+    void setPermissions(int p) { makeValid(); _permissions = quint16(p); }
+    void setFlag(Flag flag, bool on = true);
+
+    void setDir(bool b) { setFlag(Dir, b); }
+    void setFile(bool b) { setFlag(File, b); }
+    void setSymLink(bool b) { setFlag(SymLink, b); }
+    void setWritable(bool b) { setFlag(Writable, b); }
+    void setReadable(bool b) { setFlag(Readable, b); }
+    void setDateOnly(bool b) { setFlag(DateOnly, b); }
+
+    bool operator==(const FtpDirEntry &other) const;
+    bool operator!=(const FtpDirEntry &other) const { return !operator==(other); }
+
+private:
+    void makeValid();
+
+    QString _name;
+    QString _owner;
+    QString _group;
+    qint64 _size = 0;
+    qint64 _mtime = NoTime;
+    quint16 _permissions = 0;
+    quint8 _flags = 0;
+};
+
+Q_DECLARE_TYPEINFO(FtpDirEntry, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(FtpDirEntry)
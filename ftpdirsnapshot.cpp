@@ -0,0 +1,171 @@
+#include "ftpdirsnapshot.h"
+
+FtpDirSnapshot::FtpDirSnapshot()
+{
+    _nameOffsets.append(0);
+}
+
+void FtpDirSnapshot::clear()
+{
+    _names.clear();
+    _nameOffsets.clear();
+    _nameOffsets.append(0);
+    _sizes.clear();
+    _mtimes.clear();
+    _permissions.clear();
+    _flags.clear();
+    _owners.clear();
+    _groups.clear();
+    _strings.clear();
+    _stringIds.clear();
+    _index.clear();
+}
+
+void FtpDirSnapshot::reserve(int entries, int nameChars)
+{
+    _names.reserve(nameChars);
+    _nameOffsets.reserve(entries + 1);
+    _sizes.reserve(entries);
+    _mtimes.reserve(entries);
+    _permissions.reserve(entries);
+    _flags.reserve(entries);
+    _owners.reserve(entries);
+    _groups.reserve(entries);
+}
+
+void FtpDirSnapshot::squeeze()
+{
+    _names.squeeze();
+    _nameOffsets.squeeze();
+    _sizes.squeeze();
+    _mtimes.squeeze();
+    _permissions.squeeze();
+    _flags.squeeze();
+    _owners.squeeze();
+    _groups.squeeze();
+}
+
+void FtpDirSnapshot::append(const FtpDirEntry &entry)
+{
+    _names.append(entry.name());
+    _nameOffsets.append(quint32(_names.size()));
+    _sizes.append(entry.size());
+    _mtimes.append(entry.lastModifiedSecs());
+    _permissions.append(quint16(entry.permissions()));
+    _flags.append(entry.flags());
+    _owners.append(stringId(entry.owner()));
+    _groups.append(stringId(entry.group()));
+    if (!_index.isEmpty()) {
+        // Держим заполненность индекса не выше половины.
+        if (size() * 2 > _index.size()) {
+            rebuildIndex();
+        } else {
+            insertIntoIndex(size() - 1);
+        }
+    }
+}
+
+QStringView FtpDirSnapshot::name(int i) const
+{
+    const quint32 begin = _nameOffsets.at(i);
+    return QStringView(_names.constData() + begin, int(_nameOffsets.at(i + 1) - begin));
+}
+
+FtpDirEntry FtpDirSnapshot::entry(int i) const
+{
+    FtpDirEntry e;
+    e.setName(name(i).toString());
+    e.setOwner(owner(i));
+    e.setGroup(group(i));
+    e.setSize(size(i));
+    e.setLastModifiedSecs(lastModifiedSecs(i));
+    e.setPermissions(permissions(i));
+    const quint8 f = flags(i);
+    for (auto flag : {FtpDirEntry::Dir, FtpDirEntry::File, FtpDirEntry::SymLink,
+                      FtpDirEntry::Writable, FtpDirEntry::Readable, FtpDirEntry::Executable}) {
+        e.setFlag(flag, f & flag);
+    }
+    return e;
+}
+
+int FtpDirSnapshot::indexOf(QStringView name) const
+{
+    if (isEmpty()) {
+        return -1;
+    }
+    if (_index.isEmpty()) {
+        rebuildIndex();
+    }
+    const int mask = _index.size() - 1;
+    for (int slot = int(qHash(name)) & mask; ; slot = (slot + 1) & mask) {
+        const int i = _index.at(slot) - 1;
+        if (i < 0) {
+            return -1;
+        }
+        if (this->name(i) == name) {
+            return i;
+        }
+    }
+}
+
+QVector<int> FtpDirSnapshot::sortedIndexes(FtpListSorter::SortKey key, Qt::SortOrder order,
+                                           FtpListSorter::Options options) const
+{
+    return FtpListSorter(key, order, options).sort(*this);
+}
+
+qint64 FtpDirSnapshot::memoryUsage() const
+{
+    qint64 bytes = sizeof(*this);
+    bytes += qint64(_names.capacity()) * qint64(sizeof(QChar));
+    bytes += qint64(_nameOffsets.capacity()) * qint64(sizeof(quint32));
+    bytes += qint64(_sizes.capacity() + _mtimes.capacity()) * qint64(sizeof(qint64));
+    bytes += qint64(_permissions.capacity()) * qint64(sizeof(quint16));
+    bytes += qint64(_flags.capacity()) * qint64(sizeof(quint8));
+    bytes += qint64(_owners.capacity() + _groups.capacity()) * qint64(sizeof(quint32));
+    bytes += qint64(_index.capacity()) * qint64(sizeof(int));
+    for (const QString &s : _strings) {
+        // Строка хранится и в _strings, и ключом в _stringIds.
+        bytes += 2 * qint64(sizeof(QString)) + qint64(s.capacity()) * qint64(sizeof(QChar));
+    }
+    return bytes;
+}
+
+double FtpDirSnapshot::bytesPerEntry() const
+{
+    return isEmpty() ? 0.0 : double(memoryUsage()) / size();
+}
+
+quint32 FtpDirSnapshot::stringId(const QString &s)
+{
+    auto it = _stringIds.constFind(s);
+    if (it != _stringIds.constEnd()) {
+        return it.value();
+    }
+    const quint32 id = quint32(_strings.size());
+    _strings.append(s);
+    _stringIds.insert(s, id);
+    return id;
+}
+
+void FtpDirSnapshot::insertIntoIndex(int i) const
+{
+    const int mask = _index.size() - 1;
+    int slot = int(qHash(name(i))) & mask;
+    while (_index.at(slot)) {
+        slot = (slot + 1) & mask;
+    }
+    _index[slot] = i + 1;
+}
+
+void FtpDirSnapshot::rebuildIndex() const
+{
+    int capacity = 16;
+    while (capacity < size() * 4) {
+        capacity *= 2;
+    }
+    _index.fill(0, capacity);
+    for (int i = 0; i < size(); ++i) {
+        insertIntoIndex(i);
+    }
+}
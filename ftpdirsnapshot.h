@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QStringView>
+#include <QVector>
+#include <ftpdirentry.h>
+#include <ftplistsorter.h>
+
+// Снимок содержимого каталога в виде "структуры массивов".
+// Имена лежат подряд в одном буфере (арене), размеры, времена, права
+// и флаги - в параллельных массивах, владелец и группа - индексами в
+// общей таблице строк. Так миллионы записей не разбрасываются по куче
+// и сортировка/просмотр идут по плотным массивам.
+// Заполняется напрямую парсером листинга: QFtp::list(dir, snapshot).
+class FtpDirSnapshot
+{
+public:
+    // Лёгкий доступ к одной записи снимка без копирования.
+    class Entry
+    {
+    public:
+        Entry(const FtpDirSnapshot *s, int i) : _s(s), _i(i) {}
+
+        int index() const { return _i; }
+        QStringView name() const { return _s->name(_i); }
+        const QString &owner() const { return _s->owner(_i); }
+        const QString &group() const { return _s->group(_i); }
+        qint64 size() const { return _s->size(_i); }
+        qint64 lastModifiedSecs() const { return _s->lastModifiedSecs(_i); }
+        int permissions() const { return _s->permissions(_i); }
+        quint8 flags() const { return _s->flags(_i); }
+        bool isDir() const { return _s->isDir(_i); }
+        FtpDirEntry toEntry() const { return _s->entry(_i); }
+
+    private:
+        const FtpDirSnapshot *_s;
+        int _i;
+    };
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const FtpDirSnapshot *s, int i) : _s(s), _i(i) {}
+
+        Entry operator*() const { return Entry(_s, _i); }
+        const_iterator &operator++() { ++_i; return *this; }
+        bool operator==(const const_iterator &o) const { return _i == o._i && _s == o._s; }
+        bool operator!=(const const_iterator &o) const { return !operator==(o); }
+
+    private:
+        const FtpDirSnapshot *_s;
+        int _i;
+    };
+
+    FtpDirSnapshot();
+
+    int size() const { return _sizes.size(); }
+    bool isEmpty() const { return _sizes.isEmpty(); }
+    void clear();
+    // nameChars - ожидаемая суммарная длина имён.
+    void reserve(int entries, int nameChars = 0);
+    void squeeze();
+
+    void append(const FtpDirEntry &entry);
+
+    QStringView name(int i) const;
+    const QString &owner(int i) const { return _strings.at(int(_owners.at(i))); }
+    const QString &group(int i) const { return _strings.at(int(_groups.at(i))); }
+    qint64 size(int i) const { return _sizes.at(i); }
+    qint64 lastModifiedSecs(int i) const { return _mtimes.at(i); }
+    int permissions(int i) const { return _permissions.at(i); }
+    quint8 flags(int i) const { return _flags.at(i); }
+    bool isDir(int i) const { return _flags.at(i) & FtpDirEntry::Dir; }
+    FtpDirEntry entry(int i) const;
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    // Поиск по имени через хеш-индекс, строится при первом обращении.
+    int indexOf(QStringView name) const;
+    bool contains(QStringView name) const { return indexOf(name) >= 0; }
+
+    // Порядок записей по ключу; сам снимок не переставляется.
+    QVector<int> sortedIndexes(FtpListSorter::SortKey key,
+                               Qt::SortOrder order = Qt::AscendingOrder,
+                               FtpListSorter::Options options = FtpListSorter::NoOptions) const;
+
+    // Сколько памяти занимает снимок, всего и в среднем на запись.
+    qint64 memoryUsage() const;
+    double bytesPerEntry() const;
+
+private:
+    quint32 stringId(const QString &s);
+    void insertIntoIndex(int i) const;
+    void rebuildIndex() const;
+
+    QString _names;
+    // _nameOffsets[i]..._nameOffsets[i + 1] - имя i-й записи в _names.
+    QVector<quint32> _nameOffsets;
+    QVector<qint64> _sizes;
+    QVector<qint64> _mtimes;
+    QVector<quint16> _permissions;
+    QVector<quint8> _flags;
+    QVector<quint32> _owners;
+    QVector<quint32> _groups;
+
+    QVector<QString> _strings;
+    QHash<QString, quint32> _stringIds;
+
+    // Открытая адресация: номера записей + 1, 0 - пустая ячейка.
+    mutable QVector<int> _index;
+};
@@ -0,0 +1,248 @@
+#include "ftpdirwatcher.h"
+
+#include <QCryptographicHash>
+#include <QHash>
+#include <QIODevice>
+#include <qftp.h>
+
+// Принимает листинг от QFtp, считая хеш на лету.
+class FtpDirWatcher::Sink : public QIODevice
+{
+public:
+    Sink() : _hash(QCryptographicHash::Md5) { }
+
+    void reset()
+    {
+        _hash.reset();
+        _data.clear();
+        if (!isOpen()) {
+            open(QIODevice::WriteOnly);
+        }
+    }
+    QByteArray hash() const { return _hash.result(); }
+    const QByteArray &data() const { return _data; }
+    void release() { _data.clear(); }
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+    qint64 writeData(const char *data, qint64 len) override
+    {
+        _hash.addData(data, int(len));
+        _data.append(data, int(len));
+        return len;
+    }
+
+private:
+    QCryptographicHash _hash;
+    QByteArray _data;
+};
+
+FtpDirWatcher::FtpDirWatcher(QObject *parent)
+    : QObject(parent), _sink(new Sink)
+{
+    _timer.setSingleShot(true);
+    connect(&_timer, &QTimer::timeout, this, &FtpDirWatcher::poll);
+}
+
+FtpDirWatcher::~FtpDirWatcher()
+{
+    closeSession();
+    delete _sink;
+}
+
+void FtpDirWatcher::setSession(const QString &host, quint16 port, const QString &user, const QString &password)
+{
+    if (host != _host || port != _port || user != _user || password != _password) {
+        closeSession();
+    }
+    _host = host;
+    _port = port;
+    _user = user;
+    _password = password;
+}
+
+QString FtpDirWatcher::path() const
+{
+    return _path;
+}
+
+void FtpDirWatcher::setPath(const QString &dir)
+{
+    setPath(dir, QVector<FtpDirEntry>());
+    _known = false;
+}
+
+void FtpDirWatcher::setPath(const QString &dir, const QVector<FtpDirEntry> &known)
+{
+    _path = dir;
+    _hash.clear();
+    _entries = known;
+    _known = true;
+    _interval = _minInterval;
+    // Опрос прежнего каталога, если он идёт, будет отброшен.
+    if (_timer.isActive()) {
+        _timer.start(_interval);
+    }
+}
+
+int FtpDirWatcher::minInterval() const
+{
+    return _minInterval;
+}
+
+int FtpDirWatcher::maxInterval() const
+{
+    return _maxInterval;
+}
+
+void FtpDirWatcher::setInterval(int minMsec, int maxMsec)
+{
+    _minInterval = qMax(1, minMsec);
+    _maxInterval = qMax(_minInterval, maxMsec);
+    _interval = qBound(_minInterval, _interval, _maxInterval);
+}
+
+int FtpDirWatcher::currentInterval() const
+{
+    return _interval;
+}
+
+bool FtpDirWatcher::isActive() const
+{
+    return _timer.isActive() || _listId != 0;
+}
+
+QVector<FtpDirEntry> FtpDirWatcher::entries() const
+{
+    return _entries;
+}
+
+void FtpDirWatcher::start()
+{
+    if (!isActive()) {
+        _timer.start(_interval);
+    }
+}
+
+void FtpDirWatcher::stop()
+{
+    _timer.stop();
+    closeSession();
+}
+
+void FtpDirWatcher::closeSession()
+{
+    _listId = 0;
+    if (_ftp) {
+        _ftp->disconnect(this);
+        _ftp->abort();
+        _ftp->deleteLater();
+        _ftp = nullptr;
+    }
+}
+
+void FtpDirWatcher::poll()
+{
+    if (_host.isEmpty()) {
+        return;
+    }
+    if (!_ftp) {
+        _ftp = new QFtp(this);
+        _ftp->setFastAbort(true);
+        connect(_ftp, &QFtp::commandFinished, this, &FtpDirWatcher::commandFinishedSlot);
+        _ftp->connectToHost(_host, _port);
+        _ftp->login(_user, _password);
+    }
+    _sink->reset();
+    _listedPath = _path;
+    _listId = _ftp->listRaw(_path, _sink);
+}
+
+void FtpDirWatcher::commandFinishedSlot(int id, bool error)
+{
+    if (id != _listId) {
+        if (error) {
+            // Не удалось подключиться или войти; попробуем в следующий раз.
+            emit this->error(_ftp->errorString());
+            closeSession();
+            _interval = qMin(_interval * 2, _maxInterval);
+            _timer.start(_interval);
+        }
+        return;
+    }
+    _listId = 0;
+    if (error) {
+        emit this->error(_ftp->errorString());
+        if (_ftp->state() == QFtp::Unconnected) {
+            closeSession();
+        }
+        _interval = qMin(_interval * 2, _maxInterval);
+    } else if (_listedPath == _path) {
+        listed();
+    }
+    _sink->release();
+    _timer.start(_interval);
+}
+
+void FtpDirWatcher::listed()
+{
+    const QByteArray hash = _sink->hash();
+    if (hash == _hash) {
+        // Тот же листинг: не разбираем, реже опрашиваем.
+        _interval = qMin(_interval * 3 / 2, _maxInterval);
+        return;
+    }
+    const bool first = _hash.isEmpty() && !_known;
+    _hash = hash;
+
+    QVector<FtpDirEntry> entries;
+    const QByteArray &data = _sink->data();
+    int pos = 0;
+    while (pos < data.size()) {
+        int end = data.indexOf('\n', pos);
+        if (end < 0) {
+            end = data.size();
+        }
+        FtpDirEntry entry;
+        if (QFtp::parseDirEntry(QByteArray::fromRawData(data.constData() + pos, end - pos), &entry)
+                && entry.name() != QLatin1String(".") && entry.name() != QLatin1String("..")) {
+            entries.append(entry);
+        }
+        pos = end + 1;
+    }
+
+    QVector<FtpDirEntry> added;
+    QVector<FtpDirEntry> removed;
+    QVector<FtpDirEntry> modified;
+    if (!first) {
+        QHash<QString, int> previous;
+        previous.reserve(_entries.size());
+        for (int i = 0; i < _entries.size(); ++i) {
+            previous.insert(_entries.at(i).name(), i);
+        }
+        for (const auto &entry : qAsConst(entries)) {
+            const auto it = previous.find(entry.name());
+            if (it == previous.end()) {
+                added.append(entry);
+                continue;
+            }
+            if (_entries.at(*it) != entry) {
+                modified.append(entry);
+            }
+            previous.erase(it);
+        }
+        for (int i : qAsConst(previous)) {
+            removed.append(_entries.at(i));
+        }
+    }
+    _entries = entries;
+    _known = false;
+
+    if (added.isEmpty() && removed.isEmpty() && modified.isEmpty()) {
+        _interval = qMin(_interval * 3 / 2, _maxInterval);
+        return;
+    }
+    // Каталог меняется - смотрим чаще.
+    _interval = _minInterval;
+    emit changed(added, removed, modified);
+}
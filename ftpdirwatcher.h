@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QByteArray>
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <ftpdirentry.h>
+
+class QFtp;
+
+// Наблюдение за каталогом сервера опросом на отдельном соединении.
+// Листинг принимается сырыми байтами (QFtp::listRaw()) и хешируется по
+// мере поступления. Совпал хеш с прошлым опросом - листинг даже не
+// разбирается. Иначе он разбирается и сравнивается с прошлым по имени,
+// а changed() сообщает только добавленные, удалённые и изменённые записи.
+// Интервал подстраивается: после изменения - minInterval(), пока
+// ничего не меняется, растёт в полтора раза до maxInterval().
+class FtpDirWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FtpDirWatcher(QObject *parent = nullptr);
+    ~FtpDirWatcher() override;
+
+    void setSession(const QString &host, quint16 port, const QString &user, const QString &password);
+
+    QString path() const;
+    // Содержимое каталога неизвестно: первый опрос только запоминает листинг.
+    void setPath(const QString &dir);
+    // known - уже известное содержимое каталога, пусть и пустое: первый
+    // опрос сравнится с ним.
+    void setPath(const QString &dir, const QVector<FtpDirEntry> &known);
+
+    int minInterval() const;
+    int maxInterval() const;
+    void setInterval(int minMsec, int maxMsec);
+    int currentInterval() const;
+
+    bool isActive() const;
+    // Содержимое каталога по последнему опросу.
+    QVector<FtpDirEntry> entries() const;
+
+public slots:
+    void start();
+    void stop();
+
+signals:
+    void changed(const QVector<FtpDirEntry> &added, const QVector<FtpDirEntry> &removed,
+                 const QVector<FtpDirEntry> &modified);
+    void error(const QString &message);
+
+private slots:
+    void poll();
+    void commandFinishedSlot(int id, bool error);
+
+private:
+    class Sink;
+
+    void closeSession();
+    void listed();
+
+    QString _host;
+    quint16 _port = 21;
+    QString _user;
+    QString _password;
+
+    QString _path;
+    QFtp *_ftp = nullptr;
+    Sink *_sink = nullptr;
+    int _listId = 0;
+    // Каталог выполняемого опроса.
+    QString _listedPath;
+    QTimer _timer;
+    int _minInterval = 2000;
+    int _maxInterval = 60000;
+    int _interval = 2000;
+
+    // Хеш сырого листинга прошлого опроса, пустой - ещё не было.
+    QByteArray _hash;
+    QVector<FtpDirEntry> _entries;
+    bool _known = false;
+};
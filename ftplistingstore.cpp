@@ -0,0 +1,351 @@
+#include "ftplistingstore.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <QHash>
+#include <QSaveFile>
+
+namespace {
+const char MAGIC[8] = {'Q', 'F', 'T', 'P', 'L', 'I', 'S', 'T'};
+constexpr quint32 VERSION = 1;
+constexpr quint32 BYTE_ORDER_MARK = 0x01020304;
+constexpr quint32 NO_STRING = 0xffffffff;
+
+qint64 align8(qint64 offset)
+{
+    return (offset + 7) & ~qint64(7);
+}
+}
+
+struct FtpListingStore::Header {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 dirCount;
+    quint32 entryCount;
+    quint32 stringCount;
+    quint32 host;
+    quint64 dirsOffset;
+    quint64 entriesOffset;
+    quint64 stringsOffset;
+    quint64 arenaOffset;
+    // Длина арены в символах UTF-16.
+    quint64 arenaLength;
+    quint64 fileSize;
+    // qChecksum() всех полей выше.
+    quint32 checksum;
+    quint32 reserved;
+};
+
+struct FtpListingStore::DirRecord {
+    quint32 path;
+    quint32 firstEntry;
+    quint32 entryCount;
+    quint32 reserved;
+    qint64 stamp;
+};
+
+struct FtpListingStore::EntryRecord {
+    quint32 name;
+    quint32 owner;
+    quint32 group;
+    quint16 permissions;
+    quint8 flags;
+    quint8 reserved;
+    qint64 size;
+    qint64 mtime;
+};
+
+struct FtpListingStore::StringRecord {
+    quint32 offset;
+    quint32 length;
+};
+
+FtpListingStore::~FtpListingStore()
+{
+    close();
+}
+
+bool FtpListingStore::open(const QString &fileName)
+{
+    close();
+    _file.setFileName(fileName);
+    if (!_file.open(QIODevice::ReadOnly)) {
+        _error = _file.errorString();
+        return false;
+    }
+    _size = _file.size();
+    _data = _size > 0 ? _file.map(0, _size) : nullptr;
+    if (!_data) {
+        _error = _size > 0 ? _file.errorString() : QStringLiteral("Empty listing store");
+        close();
+        return false;
+    }
+    if (!validate()) {
+        const QString error = _error;
+        close();
+        _error = error;
+        return false;
+    }
+    return true;
+}
+
+void FtpListingStore::close()
+{
+    if (_data) {
+        _file.unmap(_data);
+        _data = nullptr;
+    }
+    _file.close();
+    _size = 0;
+    _error.clear();
+}
+
+bool FtpListingStore::validate()
+{
+    // Формат файла зависит от раскладки этих структур.
+    static_assert(sizeof(Header) == 88, "layout of the store header changed");
+    static_assert(sizeof(DirRecord) == 24, "layout of the directory record changed");
+    static_assert(sizeof(EntryRecord) == 32, "layout of the entry record changed");
+    static_assert(sizeof(StringRecord) == 8, "layout of the string record changed");
+
+    const auto fail = [this](const char *what) {
+        _error = QStringLiteral("Invalid listing store: ") + QLatin1String(what);
+        return false;
+    };
+    if (_size < qint64(sizeof(Header))) {
+        return fail("truncated header");
+    }
+    const Header *h = header();
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        return fail("bad magic");
+    }
+    if (h->version != VERSION) {
+        return fail("unsupported version");
+    }
+    if (h->byteOrder != BYTE_ORDER_MARK) {
+        return fail("foreign byte order");
+    }
+    if (h->checksum != qChecksum(reinterpret_cast<const char *>(h), offsetof(Header, checksum))) {
+        return fail("header checksum mismatch");
+    }
+    if (h->fileSize != quint64(_size)) {
+        return fail("size mismatch");
+    }
+    const auto fits = [this](quint64 offset, quint64 count, quint64 recordSize) {
+        return offset % 8 == 0 && offset <= quint64(_size)
+                && count <= (quint64(_size) - offset) / recordSize;
+    };
+    if (!fits(h->dirsOffset, h->dirCount, sizeof(DirRecord))
+            || !fits(h->entriesOffset, h->entryCount, sizeof(EntryRecord))
+            || !fits(h->stringsOffset, h->stringCount, sizeof(StringRecord))
+            || !fits(h->arenaOffset, h->arenaLength, sizeof(char16_t))) {
+        return fail("table out of bounds");
+    }
+    // Каталогов немного, проверяем их все: диапазоны записей и порядок путей.
+    QStringView previous;
+    for (int i = 0; i < int(h->dirCount); ++i) {
+        const DirRecord *d = dirRecord(i);
+        if (d->firstEntry > h->entryCount || d->entryCount > h->entryCount - d->firstEntry) {
+            return fail("entry range out of bounds");
+        }
+        if (d->path >= h->stringCount) {
+            return fail("directory path out of bounds");
+        }
+        const QStringView p = string(d->path);
+        if (i > 0 && previous.compare(p) >= 0) {
+            return fail("directories not sorted");
+        }
+        previous = p;
+    }
+    return true;
+}
+
+const FtpListingStore::Header *FtpListingStore::header() const
+{
+    return reinterpret_cast<const Header *>(_data);
+}
+
+const FtpListingStore::DirRecord *FtpListingStore::dirRecord(int dir) const
+{
+    return reinterpret_cast<const DirRecord *>(_data + header()->dirsOffset) + dir;
+}
+
+QStringView FtpListingStore::string(quint32 id) const
+{
+    const Header *h = header();
+    if (id >= h->stringCount) {
+        return QStringView();
+    }
+    const StringRecord *s = reinterpret_cast<const StringRecord *>(_data + h->stringsOffset) + id;
+    if (s->offset > h->arenaLength || s->length > h->arenaLength - s->offset) {
+        return QStringView();
+    }
+    return QStringView(reinterpret_cast<const char16_t *>(_data + h->arenaOffset) + s->offset, s->length);
+}
+
+QString FtpListingStore::host() const
+{
+    return isOpen() ? string(header()->host).toString() : QString();
+}
+
+int FtpListingStore::directoryCount() const
+{
+    return isOpen() ? int(header()->dirCount) : 0;
+}
+
+QStringView FtpListingStore::path(int dir) const
+{
+    return string(dirRecord(dir)->path);
+}
+
+qint64 FtpListingStore::stamp(int dir) const
+{
+    return dirRecord(dir)->stamp;
+}
+
+int FtpListingStore::entryCount(int dir) const
+{
+    return int(dirRecord(dir)->entryCount);
+}
+
+int FtpListingStore::indexOf(QStringView path) const
+{
+    int lo = 0;
+    int hi = directoryCount();
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        const int c = this->path(mid).compare(path);
+        if (c == 0) {
+            return mid;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+QVector<FtpDirEntry> FtpListingStore::entries(int dir) const
+{
+    const DirRecord *d = dirRecord(dir);
+    const EntryRecord *records = reinterpret_cast<const EntryRecord *>(_data + header()->entriesOffset) + d->firstEntry;
+    // Владелец и группа у записей каталога почти всегда общие.
+    QHash<quint32, QString> shared;
+    const auto sharedString = [this, &shared](quint32 id) {
+        auto it = shared.find(id);
+        if (it == shared.end()) {
+            it = shared.insert(id, string(id).toString());
+        }
+        return *it;
+    };
+    static const FtpDirEntry::Flag FLAGS[] = {
+        FtpDirEntry::Dir, FtpDirEntry::File, FtpDirEntry::SymLink,
+        FtpDirEntry::Writable, FtpDirEntry::Readable, FtpDirEntry::Executable
+    };
+    QVector<FtpDirEntry> result;
+    result.reserve(int(d->entryCount));
+    for (quint32 i = 0; i < d->entryCount; ++i) {
+        const EntryRecord &r = records[i];
+        FtpDirEntry entry;
+        entry.setName(string(r.name).toString());
+        entry.setOwner(sharedString(r.owner));
+        entry.setGroup(sharedString(r.group));
+        entry.setSize(r.size);
+        entry.setLastModifiedSecs(r.mtime);
+        entry.setPermissions(r.permissions);
+        for (const auto flag : FLAGS) {
+            entry.setFlag(flag, r.flags & flag);
+        }
+        result.append(entry);
+    }
+    return result;
+}
+
+FtpListingStore::Directory FtpListingStore::directory(int dir) const
+{
+    return {path(dir).toString(), stamp(dir), entries(dir)};
+}
+
+bool FtpListingStore::write(const QString &fileName, const QString &host,
+                            QVector<Directory> dirs, QString *errorString)
+{
+    std::sort(dirs.begin(), dirs.end(), [](const Directory &a, const Directory &b) {
+        return QStringView(a.path).compare(b.path) < 0;
+    });
+    dirs.erase(std::unique(dirs.begin(), dirs.end(), [](const Directory &a, const Directory &b) {
+        return a.path == b.path;
+    }), dirs.end());
+
+    QString arena;
+    QVector<StringRecord> strings;
+    QHash<QString, quint32> stringIds;
+    const auto stringId = [&](const QString &s) {
+        auto it = stringIds.constFind(s);
+        if (it != stringIds.cend()) {
+            return *it;
+        }
+        const quint32 id = quint32(strings.size());
+        strings.append({quint32(arena.size()), quint32(s.size())});
+        arena += s;
+        stringIds.insert(s, id);
+        return id;
+    };
+
+    QVector<DirRecord> dirRecords;
+    dirRecords.reserve(dirs.size());
+    QVector<EntryRecord> entryRecords;
+    for (const auto &d : qAsConst(dirs)) {
+        dirRecords.append({stringId(d.path), quint32(entryRecords.size()), quint32(d.entries.size()), 0, d.stamp});
+        for (const auto &e : d.entries) {
+            entryRecords.append({stringId(e.name()), stringId(e.owner()), stringId(e.group()),
+                                 quint16(e.permissions()), e.flags(), 0, e.size(), e.lastModifiedSecs()});
+        }
+    }
+
+    Header h = {};
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.byteOrder = BYTE_ORDER_MARK;
+    h.dirCount = quint32(dirRecords.size());
+    h.entryCount = quint32(entryRecords.size());
+    h.host = host.isNull() ? NO_STRING : stringId(host);
+    h.stringCount = quint32(strings.size());
+    h.dirsOffset = quint64(align8(sizeof(Header)));
+    h.entriesOffset = quint64(align8(qint64(h.dirsOffset) + dirRecords.size() * qint64(sizeof(DirRecord))));
+    h.stringsOffset = quint64(align8(qint64(h.entriesOffset) + entryRecords.size() * qint64(sizeof(EntryRecord))));
+    h.arenaOffset = quint64(align8(qint64(h.stringsOffset) + strings.size() * qint64(sizeof(StringRecord))));
+    h.arenaLength = quint64(arena.size());
+    h.fileSize = h.arenaOffset + h.arenaLength * sizeof(char16_t);
+    h.checksum = qChecksum(reinterpret_cast<const char *>(&h), offsetof(Header, checksum));
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorString) {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    const auto put = [&file](quint64 offset, const void *data, qint64 size) {
+        static const char PADDING[8] = {};
+        const qint64 gap = qint64(offset) - file.pos();
+        Q_ASSERT(gap >= 0 && gap < 8);
+        file.write(PADDING, gap);
+        file.write(static_cast<const char *>(data), size);
+    };
+    put(0, &h, sizeof(h));
+    put(h.dirsOffset, dirRecords.constData(), dirRecords.size() * qint64(sizeof(DirRecord)));
+    put(h.entriesOffset, entryRecords.constData(), entryRecords.size() * qint64(sizeof(EntryRecord)));
+    put(h.stringsOffset, strings.constData(), strings.size() * qint64(sizeof(StringRecord)));
+    put(h.arenaOffset, arena.constData(), arena.size() * qint64(sizeof(char16_t)));
+    if (!file.commit()) {
+        if (errorString) {
+            *errorString = file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
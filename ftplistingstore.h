@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QFile>
+#include <QString>
+#include <QStringView>
+#include <QVector>
+#include <ftpdirentry.h>
+
+// Файл снимка листингов, читаемый через отображение в память.
+//
+// Формат (порядок байт машины, все таблицы выровнены на 8 байт):
+//   Header     - сигнатура, версия, метка порядка байт, размеры и
+//                смещения таблиц, контрольная сумма заголовка;
+//   DirRecord  - по каталогу, отсортированы по пути: путь, диапазон
+//                записей, время листинга;
+//   EntryRecord- записи фиксированной длины: строки - номерами в
+//                таблице строк, размер, время, права, флаги;
+//   StringRecord - смещение и длина строки в арене;
+//   арена      - все строки подряд в UTF-16, одинаковые хранятся один раз.
+// При открытии проверяются заголовок и таблица каталогов, границы
+// записей и строк - при каждом обращении, так что испорченный файл
+// даёт пустые строки, а не чтение за пределами отображения.
+class FtpListingStore
+{
+public:
+    struct Directory {
+        QString path;
+        // Время листинга, секунды от эпохи.
+        qint64 stamp = 0;
+        QVector<FtpDirEntry> entries;
+    };
+
+    FtpListingStore() = default;
+    ~FtpListingStore();
+    FtpListingStore(const FtpListingStore &) = delete;
+    FtpListingStore &operator=(const FtpListingStore &) = delete;
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return _data != nullptr; }
+    QString fileName() const { return _file.fileName(); }
+    QString errorString() const { return _error; }
+
+    // Сервер, с которого сняты листинги.
+    QString host() const;
+
+    int directoryCount() const;
+    QStringView path(int dir) const;
+    qint64 stamp(int dir) const;
+    int entryCount(int dir) const;
+    // Номер каталога по пути (двоичный поиск) или -1.
+    int indexOf(QStringView path) const;
+    QVector<FtpDirEntry> entries(int dir) const;
+    Directory directory(int dir) const;
+
+    // Записывает снимок атомарно (через QSaveFile).
+    static bool write(const QString &fileName, const QString &host,
+                      QVector<Directory> dirs, QString *errorString = nullptr);
+
+private:
+    struct Header;
+    struct DirRecord;
+    struct EntryRecord;
+    struct StringRecord;
+
+    const Header *header() const;
+    const DirRecord *dirRecord(int dir) const;
+    QStringView string(quint32 id) const;
+    bool validate();
+
+    QFile _file;
+    uchar *_data = nullptr;
+    qint64 _size = 0;
+    QString _error;
+};
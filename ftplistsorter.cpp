@@ -0,0 +1,219 @@
+#include "ftplistsorter.h"
+
+#include <algorithm>
+#include <vector>
+#include <QCollator>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <ftpdirsnapshot.h>
+
+namespace {
+
+template <typename K>
+struct Keyed {
+    K key;
+    int group;
+    int index;
+};
+
+inline int compareKeys(qint64 a, qint64 b)
+{
+    return a < b ? -1 : (b < a ? 1 : 0);
+}
+
+inline int compareKeys(const QString &a, const QString &b)
+{
+    return QString::compare(a, b);
+}
+
+inline int compareKeys(QStringView a, QStringView b)
+{
+    return a.compare(b);
+}
+
+inline int compareKeys(const QCollatorSortKey &a, const QCollatorSortKey &b)
+{
+    return a.compare(b);
+}
+
+// Полный порядок: группа, ключ, исходный номер. Поэтому std::sort
+// даёт тот же результат, что и устойчивая сортировка.
+template <typename K>
+struct KeyedLess {
+    bool descending;
+
+    bool operator()(const Keyed<K> &a, const Keyed<K> &b) const
+    {
+        if (a.group != b.group) {
+            return a.group < b.group;
+        }
+        const int c = compareKeys(a.key, b.key);
+        if (c != 0) {
+            return descending ? c > 0 : c < 0;
+        }
+        return a.index < b.index;
+    }
+};
+
+struct MergeJob {
+    int begin;
+    int middle;
+    int end;
+};
+
+template <typename K>
+QVector<int> sortKeyed(std::vector<Keyed<K>> &keys, bool descending, int parallelThreshold)
+{
+    const KeyedLess<K> less{descending};
+    const int n = int(keys.size());
+    const int parts = QThread::idealThreadCount();
+    if (parallelThreshold <= 0 || n < parallelThreshold || parts < 2) {
+        std::sort(keys.begin(), keys.end(), less);
+    } else {
+        // Каждый поток сортирует свой кусок, затем куски сливаются
+        // попарно, тоже параллельно.
+        QVector<MergeJob> ranges;
+        for (int p = 0; p < parts; ++p) {
+            ranges.append(MergeJob{int(qint64(n) * p / parts), 0, int(qint64(n) * (p + 1) / parts)});
+        }
+        QtConcurrent::blockingMap(ranges, [&keys, less](MergeJob &r) {
+            std::sort(keys.begin() + r.begin, keys.begin() + r.end, less);
+        });
+        while (ranges.size() > 1) {
+            QVector<MergeJob> jobs;
+            QVector<MergeJob> next;
+            for (int i = 0; i + 1 < ranges.size(); i += 2) {
+                jobs.append(MergeJob{ranges.at(i).begin, ranges.at(i).end, ranges.at(i + 1).end});
+                next.append(MergeJob{ranges.at(i).begin, 0, ranges.at(i + 1).end});
+            }
+            if (ranges.size() % 2) {
+                next.append(ranges.last());
+            }
+            QtConcurrent::blockingMap(jobs, [&keys, less](MergeJob &j) {
+                std::inplace_merge(keys.begin() + j.begin, keys.begin() + j.middle,
+                                   keys.begin() + j.end, less);
+            });
+            ranges = next;
+        }
+    }
+
+    QVector<int> result;
+    result.reserve(n);
+    for (const auto &k : keys) {
+        result.append(k.index);
+    }
+    return result;
+}
+
+} // namespace
+
+FtpListSorter::FtpListSorter(SortKey key, Qt::SortOrder order, Options options)
+    : _key(key), _order(order), _options(options)
+{ }
+
+template <typename NameAt, typename SizeAt, typename TimeAt, typename DirAt>
+QVector<int> FtpListSorter::sortImpl(int count, NameAt nameAt, SizeAt sizeAt, TimeAt timeAt, DirAt dirAt) const
+{
+    const bool descending = _order == Qt::DescendingOrder;
+    const bool dirsFirst = _options & DirsFirst;
+    auto groupAt = [&](int i) { return dirsFirst && !dirAt(i) ? 1 : 0; };
+
+    if (_key == BySize || _key == ByTime) {
+        std::vector<Keyed<qint64>> keys;
+        keys.reserve(size_t(count));
+        for (int i = 0; i < count; ++i) {
+            keys.push_back({_key == BySize ? sizeAt(i) : timeAt(i), groupAt(i), i});
+        }
+        return sortKeyed(keys, descending, _parallelThreshold);
+    }
+
+    if (_options & LocaleAware) {
+        QCollator collator;
+        collator.setNumericMode(_options & Natural);
+        collator.setCaseSensitivity(_options & CaseInsensitive ? Qt::CaseInsensitive : Qt::CaseSensitive);
+        std::vector<Keyed<QCollatorSortKey>> keys;
+        keys.reserve(size_t(count));
+        for (int i = 0; i < count; ++i) {
+            keys.push_back({collator.sortKey(nameAt(i).toString()), groupAt(i), i});
+        }
+        return sortKeyed(keys, descending, _parallelThreshold);
+    }
+
+    if (_options & (CaseInsensitive | Natural)) {
+        std::vector<Keyed<QString>> keys;
+        keys.reserve(size_t(count));
+        for (int i = 0; i < count; ++i) {
+            QString key = nameAt(i).toString();
+            if (_options & CaseInsensitive) {
+                key = key.toCaseFolded();
+            }
+            if (_options & Natural) {
+                key = naturalKey(key);
+            }
+            keys.push_back({key, groupAt(i), i});
+        }
+        return sortKeyed(keys, descending, _parallelThreshold);
+    }
+
+    // Обычное сравнение: ключом служит само имя, без копирования.
+    std::vector<Keyed<QStringView>> keys;
+    keys.reserve(size_t(count));
+    for (int i = 0; i < count; ++i) {
+        keys.push_back({nameAt(i), groupAt(i), i});
+    }
+    return sortKeyed(keys, descending, _parallelThreshold);
+}
+
+QVector<int> FtpListSorter::sort(const QVector<FtpDirEntry> &entries) const
+{
+    return sort(entries.size(), [&entries](int i) -> const FtpDirEntry & {
+        return entries.at(i);
+    });
+}
+
+QVector<int> FtpListSorter::sort(int count, const std::function<const FtpDirEntry &(int)> &entryAt) const
+{
+    return sortImpl(count,
+                    [&entryAt](int i) { return QStringView(entryAt(i).name()); },
+                    [&entryAt](int i) { return entryAt(i).size(); },
+                    [&entryAt](int i) { return entryAt(i).lastModifiedSecs(); },
+                    [&entryAt](int i) { return entryAt(i).isDir(); });
+}
+
+QVector<int> FtpListSorter::sort(const FtpDirSnapshot &snapshot) const
+{
+    return sortImpl(snapshot.size(),
+                    [&snapshot](int i) { return snapshot.name(i); },
+                    [&snapshot](int i) { return snapshot.size(i); },
+                    [&snapshot](int i) { return snapshot.lastModifiedSecs(i); },
+                    [&snapshot](int i) { return snapshot.isDir(i); });
+}
+
+QString FtpListSorter::naturalKey(const QString &name)
+{
+    // Каждая группа цифр заменяется на '0', длину без ведущих нулей и
+    // сами цифры: при равном префиксе короткое число меньше длинного,
+    // а числа одной длины сравниваются посимвольно.
+    QString key;
+    key.reserve(name.size() + 4);
+    const QChar *p = name.constData();
+    const QChar *end = p + name.size();
+    auto isDigit = [](QChar c) { return c.unicode() >= '0' && c.unicode() <= '9'; };
+    while (p < end) {
+        if (!isDigit(*p)) {
+            key += *p++;
+            continue;
+        }
+        const QChar *digits = p;
+        while (p < end && isDigit(*p)) {
+            ++p;
+        }
+        while (digits + 1 < p && *digits == QLatin1Char('0')) {
+            ++digits;
+        }
+        key += QLatin1Char('0');
+        key += QChar(ushort(p - digits));
+        key.append(digits, int(p - digits));
+    }
+    return key;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <QFlags>
+#include <QVector>
+#include <ftpdirentry.h>
+
+class FtpDirSnapshot;
+
+// Сортировка результатов листинга.
+// Ключи (для имён - строка сравнения, для времени и размера - qint64)
+// строятся один раз, а не на каждом сравнении, как в QUrlInfo::lessThan.
+// Дальше сортируется плотный массив пар (ключ, номер); на больших
+// объёмах части сортируются параллельно и сливаются.
+// Результат - порядок номеров записей, сами данные не переставляются.
+class FtpListSorter
+{
+public:
+    enum SortKey {
+        ByName,
+        ByTime,
+        BySize
+    };
+
+    enum Option {
+        NoOptions       = 0x0,
+        CaseInsensitive = 0x1,
+        // "file9" раньше "file10".
+        Natural         = 0x2,
+        // Сравнение имён по правилам текущей локали (QCollator).
+        LocaleAware     = 0x4,
+        // Каталоги всегда идут перед файлами.
+        DirsFirst       = 0x8
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    explicit FtpListSorter(SortKey key = ByName,
+                           Qt::SortOrder order = Qt::AscendingOrder,
+                           Options options = NoOptions);
+
+    SortKey key() const { return _key; }
+    void setKey(SortKey key) { _key = key; }
+    Qt::SortOrder order() const { return _order; }
+    void setOrder(Qt::SortOrder order) { _order = order; }
+    Options options() const { return _options; }
+    void setOptions(Options options) { _options = options; }
+
+    // С какого числа записей сортировать на нескольких потоках; 0 - никогда.
+    int parallelThreshold() const { return _parallelThreshold; }
+    void setParallelThreshold(int count) { _parallelThreshold = count; }
+
+    QVector<int> sort(const QVector<FtpDirEntry> &entries) const;
+    QVector<int> sort(int count, const std::function<const FtpDirEntry &(int)> &entryAt) const;
+    QVector<int> sort(const FtpDirSnapshot &snapshot) const;
+
+    // Ключ для естественного порядка: числа сравниваются по значению.
+    static QString naturalKey(const QString &name);
+
+private:
+    template <typename NameAt, typename SizeAt, typename TimeAt, typename DirAt>
+    QVector<int> sortImpl(int count, NameAt nameAt, SizeAt sizeAt, TimeAt timeAt, DirAt dirAt) const;
+
+    SortKey _key;
+    Qt::SortOrder _order;
+    Options _options;
+    int _parallelThreshold = 100000;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FtpListSorter::Options)
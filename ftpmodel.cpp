@@ -1,9 +1,12 @@
 #include "ftpmodel.h"
 
+#include <algorithm>
 #include <array>
+#include <numeric>
+#include <QDateTime>
 #include <QDir>
 #include <QDebug>
-#include <QTimerEvent>
+#include <QMetaMethod>
 
 const std::array<QString, FtpModel::FTP_ROLE_COUNT>
         FtpModel::FTP_ROLE_STR {
@@ -22,7 +25,7 @@ FtpModel::FtpModel(bool isTable, QObject *parent)
     : QAbstractTableModel(parent), _isTable(isTable), _ftp(new QFtp(this))
 {
     connect(_ftp, &QFtp::stateChanged, this, &FtpModel::stateChangedSlot);
-    connect(_ftp, &QFtp::listInfo, this, &FtpModel::listInfoSlot);
+    connect(_ftp, &QFtp::listEntryBatch, this, &FtpModel::listEntryBatchSlot);
     connect(_ftp, &QFtp::readyRead, this, &FtpModel::readyReadSlot);
     connect(_ftp, &QFtp::dataTransferProgress, this, &FtpModel::dataTransferProgressSlot);
     connect(_ftp, &QFtp::rawCommandReply, this, &FtpModel::rawCommandReplySlot);
@@ -32,21 +35,152 @@ FtpModel::FtpModel(bool isTable, QObject *parent)
     connect(this, &QAbstractItemModel::rowsInserted, this, &FtpModel::rowCountChanged);
     connect(this, &QAbstractItemModel::rowsRemoved, this, &FtpModel::rowCountChanged);
     connect(this, &QAbstractItemModel::modelReset, this, &FtpModel::rowCountChanged);
+    _ftp->setStallDetection(_STALL_RATE, _STALL_WINDOW);
+    _ftp->setFastAbort(true);
+
+    _flushTimer.setSingleShot(true);
+    _flushTimer.setInterval(0);
+    connect(&_flushTimer, &QTimer::timeout, this, &FtpModel::flushPendingRows);
+    _progressTimer.setSingleShot(true);
+    _progressTimer.setInterval(1000 / 30);
+    connect(&_progressTimer, &QTimer::timeout, this, &FtpModel::flushProgress);
+    connect(&_prefetcher, &FtpPrefetcher::listed, this, &FtpModel::prefetchedSlot);
+    connect(&_watcher, &FtpDirWatcher::changed, this, &FtpModel::watchChangedSlot);
+    _clock.start();
 }
 
-int FtpModel::findName(QString name) const
+int FtpModel::findName(const QString &name) const
 {
-    for (int i = 0; i < _rows.size(); ++i) {
-        if (_rows.at(i).info.name() == name) {
-            return i;
+    return _nameIndex.value(name, -1);
+}
+
+QList<int> FtpModel::transfers() const
+{
+    return _transfers.keys();
+}
+
+FtpModel::Transfer FtpModel::transfer(int id) const
+{
+    return _transfers.value(id);
+}
+
+int FtpModel::transferRow(int id) const
+{
+    const auto it = _transfers.constFind(id);
+    return it == _transfers.cend() ? -1 : rowOfPath(it->path);
+}
+
+QString FtpModel::absolutePath(const QString &file) const
+{
+    return QDir::cleanPath(file.startsWith(QLatin1Char('/')) ? file : path() + QLatin1Char('/') + file);
+}
+
+int FtpModel::rowOfPath(const QString &filePath) const
+{
+    // Строка есть, только если файл лежит в показанном каталоге.
+    const int slash = filePath.lastIndexOf(QLatin1Char('/'));
+    const QString dir = slash > 0 ? filePath.left(slash) : QStringLiteral("/");
+    if (dir != QDir::cleanPath(path() + QLatin1Char('/'))) {
+        return -1;
+    }
+    return findName(filePath.mid(slash + 1));
+}
+
+int FtpModel::progressRate() const
+{
+    return 1000 / _progressTimer.interval();
+}
+
+void FtpModel::setProgressRate(int hz)
+{
+    _progressTimer.setInterval(1000 / qBound(1, hz, 1000));
+}
+
+int FtpModel::applyTransferRow(const Transfer &transfer)
+{
+    const int row = rowOfPath(transfer.path);
+    if (row >= 0) {
+        RowStruct &r = _rows[row];
+        r.state = transfer.state;
+        r.done = transfer.done;
+        r.total = transfer.total;
+    }
+    return row;
+}
+
+void FtpModel::updateTransferRow(const Transfer &transfer, const QVector<int> &roles)
+{
+    const int row = applyTransferRow(transfer);
+    if (row >= 0) {
+        emitRowsChanged(row, row, roles);
+    }
+}
+
+void FtpModel::flushProgress()
+{
+    _progressTimer.stop();
+    if (_dirtyTransfers.isEmpty()) {
+        return;
+    }
+    QVector<int> rows;
+    rows.reserve(_dirtyTransfers.size());
+    for (int id : qAsConst(_dirtyTransfers)) {
+        const auto it = _transfers.constFind(id);
+        if (it == _transfers.cend()) {
+            continue;
+        }
+        const int row = applyTransferRow(*it);
+        if (row >= 0) {
+            rows.append(row);
+        }
+        emit transferChanged(id);
+    }
+    _dirtyTransfers.clear();
+
+    // Смежные строки объединяем в диапазоны.
+    std::sort(rows.begin(), rows.end());
+    const QVector<int> roles {FtpProgressDoneRole, FtpProgressTotalRole};
+    for (int i = 0; i < rows.size();) {
+        int j = i + 1;
+        while (j < rows.size() && rows.at(j) <= rows.at(j - 1) + 1) {
+            ++j;
+        }
+        emitRowsChanged(rows.at(i), rows.at(j - 1), roles);
+        i = j;
+    }
+}
+
+void FtpModel::dropQueuedTransfers()
+{
+    // Очередь QFtp очищена: ещё не начатые загрузки уже не придут.
+    for (auto it = _transfers.begin(); it != _transfers.end();) {
+        if (it.key() == _currentTransfer) {
+            ++it;
+            continue;
         }
+        const int id = it.key();
+        it = _transfers.erase(it);
+        emit transferChanged(id);
     }
-    return -1;
 }
 
 int FtpModel::rowCount(const QModelIndex &) const
 {
-    return _rows.size();
+    return _filtering ? _filtered.size() : _visibleRows;
+}
+
+int FtpModel::sourceRow(int viewRow) const
+{
+    return _filtering ? _filtered.at(viewRow) : viewRow;
+}
+
+int FtpModel::viewRow(int sourceRow) const
+{
+    if (!_filtering) {
+        return sourceRow < _visibleRows ? sourceRow : -1;
+    }
+    const auto it = std::lower_bound(_filtered.cbegin(), _filtered.cend(), sourceRow);
+    return it != _filtered.cend() && *it == sourceRow ? int(it - _filtered.cbegin()) : -1;
 }
 
 int FtpModel::columnCount(const QModelIndex &) const
@@ -68,18 +202,21 @@ QVariant FtpModel::data(const QModelIndex &index, int role) const
         return data(this->index(index.row(), 0), index.column() + FtpRoleBegin);
     }
     Q_ASSERT(index.column() == 0);
+    const RowStruct &row = _rows.at(sourceRow(index.row()));
     switch (role) {
     case Qt::DisplayRole:
     case FtpNameRole:
-        return _rows.at(index.row()).info.name();
+        return row.entry.name();
     case FtpIsDir:
-        return _rows.at(index.row()).info.isDir();
+        return row.entry.isDir();
     case FtpSizeRole:
-        return _rows.at(index.row()).info.size();
+        return row.entry.size();
+    case FtpFileStateRole:
+        return static_cast<int>(row.state);
     case FtpProgressDoneRole:
-        return _rows.at(index.row()).done;
+        return row.done;
     case FtpProgressTotalRole:
-        return _rows.at(index.row()).total;
+        return row.total;
     default:
         break;
     }
@@ -94,17 +231,758 @@ QHash<int, QByteArray> FtpModel::roleNames() const {
     return r;
 }
 
+bool FtpModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !_filtering && _visibleRows < _rows.size();
+}
+
+void FtpModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid()) {
+        return;
+    }
+    exposeRows(_fetchPageSize > 0 ? _visibleRows + _fetchPageSize : _rows.size());
+}
+
+void FtpModel::sort(int column, Qt::SortOrder order)
+{
+    const int role = _isTable ? column + FtpRoleBegin : FtpNameRole;
+    FtpListSorter sorter(FtpListSorter::ByName, order, _sortOptions);
+    switch (role) {
+    case FtpIsDir:
+        sorter.setOptions(_sortOptions | FtpListSorter::DirsFirst);
+        break;
+    case FtpNameRole:
+        break;
+    case FtpSizeRole:
+        sorter.setKey(FtpListSorter::BySize);
+        break;
+    default:
+        // По состоянию и прогрессу не сортируем.
+        return;
+    }
+    applySort(sorter);
+}
+
+void FtpModel::sortBy(FtpListSorter::SortKey key, Qt::SortOrder order)
+{
+    applySort(FtpListSorter(key, order, _sortOptions));
+}
+
+FtpListSorter::Options FtpModel::sortOptions() const
+{
+    return _sortOptions;
+}
+
+void FtpModel::setSortOptions(FtpListSorter::Options options)
+{
+    _sortOptions = options;
+}
+
+void FtpModel::applySort(const FtpListSorter &sorter)
+{
+    flushPendingRows();
+    _sorter = sorter;
+    _sorted = true;
+    emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+    const QModelIndexList from = persistentIndexList();
+    QVector<int> fromRows;
+    fromRows.reserve(from.size());
+    for (const auto &i : from) {
+        fromRows.append(sourceRow(i.row()));
+    }
+
+    const QVector<int> order = sorter.sort(_rows.size(), [this](int i) -> const FtpDirEntry & {
+        return _rows.at(i).entry;
+    });
+    QVector<RowStruct> rows;
+    rows.reserve(_rows.size());
+    QVector<int> newRow(_rows.size());
+    for (int i = 0; i < order.size(); ++i) {
+        rows.append(_rows.at(order.at(i)));
+        newRow[order.at(i)] = i;
+    }
+    _rows.swap(rows);
+    indexRows(0);
+    if (_filterIndexEnabled) {
+        rebuildFilterIndex();
+    }
+    if (_filtering) {
+        for (int &row : _filtered) {
+            row = newRow.at(row);
+        }
+        std::sort(_filtered.begin(), _filtered.end());
+    }
+
+    QModelIndexList to;
+    to.reserve(from.size());
+    for (int i = 0; i < from.size(); ++i) {
+        // Ушедшие за видимую страницу строки теряют индекс.
+        const int row = viewRow(newRow.at(fromRows.at(i)));
+        to.append(row >= 0 ? index(row, from.at(i).column()) : QModelIndex());
+    }
+    changePersistentIndexList(from, to);
+    emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+}
+
+void FtpModel::clearRows()
+{
+    beginResetModel();
+    dropRows();
+    endResetModel();
+}
+
+void FtpModel::dropRows()
+{
+    _refreshing = false;
+    _refreshRows.clear();
+    _pendingRows.clear();
+    _flushTimer.stop();
+    if (!_rows.isEmpty()) {
+        _expectedRows = _rows.size();
+    }
+    _rows.clear();
+    _visibleRows = 0;
+    _filtered.clear();
+    _filterIndex.clear();
+    _nameIndex.clear();
+}
+
+void FtpModel::removeRowAt(int row)
+{
+    removeRowRange(row, row);
+    // Строки выше row не сдвигались, остальные переиндексируем.
+    for (auto it = _nameIndex.begin(); it != _nameIndex.end();) {
+        it = it.value() >= row ? _nameIndex.erase(it) : it + 1;
+    }
+    indexRows(row);
+}
+
+void FtpModel::removeRowRange(int first, int last)
+{
+    const int count = last - first + 1;
+    // О скрытых строках представлениям не сообщаем.
+    const int visibleLast = qMin(last, _visibleRows - 1);
+    int viewFirst = first;
+    int viewLast = visibleLast;
+    if (_filtering) {
+        viewFirst = int(std::lower_bound(_filtered.cbegin(), _filtered.cend(), first) - _filtered.cbegin());
+        viewLast = int(std::lower_bound(_filtered.cbegin(), _filtered.cend(), last + 1) - _filtered.cbegin()) - 1;
+    }
+    if (viewFirst <= viewLast) {
+        beginRemoveRows(QModelIndex(), viewFirst, viewLast);
+    }
+    if (first <= visibleLast) {
+        _visibleRows -= visibleLast - first + 1;
+    }
+    if (_filtering) {
+        _filtered.remove(viewFirst, viewLast - viewFirst + 1);
+        for (int i = viewFirst; i < _filtered.size(); ++i) {
+            _filtered[i] -= count;
+        }
+    }
+    _rows.remove(first, count);
+    if (_filterIndexEnabled) {
+        _filterIndex.remove(first, count);
+    }
+    if (viewFirst <= viewLast) {
+        endRemoveRows();
+    }
+}
+
+void FtpModel::exposeRows(int count)
+{
+    count = qMin(count, _rows.size());
+    if (count <= _visibleRows) {
+        return;
+    }
+    if (_filtering) {
+        // Видны отфильтрованные строки, страница запомнится до сброса фильтра.
+        _visibleRows = count;
+        return;
+    }
+    beginInsertRows(QModelIndex(), _visibleRows, count - 1);
+    _visibleRows = count;
+    endInsertRows();
+}
+
+void FtpModel::emitRowsChanged(int first, int last, const QVector<int> &roles)
+{
+    if (_filtering) {
+        first = int(std::lower_bound(_filtered.cbegin(), _filtered.cend(), first) - _filtered.cbegin());
+        last = int(std::lower_bound(_filtered.cbegin(), _filtered.cend(), last + 1) - _filtered.cbegin()) - 1;
+    } else {
+        last = qMin(last, _visibleRows - 1);
+    }
+    if (first <= last) {
+        emit dataChanged(index(first, 0), index(last, columnCount() - 1), roles);
+    }
+}
+
+int FtpModel::fetchPageSize() const
+{
+    return _fetchPageSize;
+}
+
+void FtpModel::setFetchPageSize(int size)
+{
+    _fetchPageSize = qMax(0, size);
+    if (_fetchPageSize == 0) {
+        exposeRows(_rows.size());
+    }
+}
+
+int FtpModel::insertBatchSize() const
+{
+    return _insertBatchSize;
+}
+
+void FtpModel::setInsertBatchSize(int size)
+{
+    _insertBatchSize = qMax(1, size);
+}
+
+bool FtpModel::diffRefresh() const
+{
+    return _diffRefresh;
+}
+
+void FtpModel::setDiffRefresh(bool enabled)
+{
+    _diffRefresh = enabled;
+}
+
+void FtpModel::applyRefresh()
+{
+    QVector<FtpDirEntry> fresh;
+    fresh.swap(_refreshRows);
+
+    QHash<QString, int> freshIndex;
+    freshIndex.reserve(fresh.size());
+    for (int i = 0; i < fresh.size(); ++i) {
+        if (!freshIndex.contains(fresh.at(i).name())) {
+            freshIndex.insert(fresh.at(i).name(), i);
+        }
+    }
+
+    // Удаляем пропавшие строки непрерывными диапазонами с конца, чтобы
+    // номера ещё не обработанных строк не сдвигались.
+    QVector<bool> seen(fresh.size(), false);
+    QVector<bool> keep(_rows.size(), false);
+    for (int i = 0; i < _rows.size(); ++i) {
+        const int j = freshIndex.value(_rows.at(i).entry.name(), -1);
+        if (j >= 0 && !seen.at(j)) {
+            seen[j] = true;
+            keep[i] = true;
+        }
+    }
+    for (int last = _rows.size() - 1; last >= 0;) {
+        if (keep.at(last)) {
+            --last;
+            continue;
+        }
+        int first = last;
+        while (first > 0 && !keep.at(first - 1)) {
+            --first;
+        }
+        removeRowRange(first, last);
+        last = first - 1;
+    }
+
+    // Изменившиеся записи обновляем, состояние загрузки сбрасываем:
+    // скачанный ранее файл уже не соответствует серверному.
+    for (int i = 0; i < _rows.size();) {
+        const FtpDirEntry &entry = fresh.at(freshIndex.value(_rows.at(i).entry.name()));
+        if (_rows.at(i).entry == entry) {
+            ++i;
+            continue;
+        }
+        const int first = i;
+        for (; i < _rows.size(); ++i) {
+            const FtpDirEntry &e = fresh.at(freshIndex.value(_rows.at(i).entry.name()));
+            if (_rows.at(i).entry == e) {
+                break;
+            }
+            RowStruct &row = _rows[i];
+            if (row.entry.size() != e.size() || row.entry.lastModifiedSecs() != e.lastModifiedSecs()) {
+                row.state = FileState::None;
+                row.done = 0;
+                row.total = 1;
+            }
+            row.entry = e;
+        }
+        emitRowsChanged(first, i - 1);
+    }
+
+    // Новые имена добавляем в конец одной вставкой.
+    for (int j = 0; j < fresh.size(); ++j) {
+        if (!seen.at(j) && freshIndex.value(fresh.at(j).name()) == j) {
+            _pendingRows.append(fresh.at(j));
+        }
+    }
+    indexRows(0);
+    flushPendingRows();
+
+    if (_sorted) {
+        applySort(_sorter);
+    }
+    // До сих пор строки вставлялись не из листинга; сам листинг сообщаем
+    // целиком, когда модель уже обновлена.
+    _refreshing = false;
+    emitListInfo(fresh);
+}
+
+QString FtpModel::filter() const
+{
+    return _filter;
+}
+
+void FtpModel::setFilter(const QString &text)
+{
+    if (text == _filter) {
+        return;
+    }
+    flushPendingRows();
+    if (!_filterIndexEnabled && !text.isEmpty()) {
+        _filterIndexEnabled = true;
+        rebuildFilterIndex();
+    }
+    const QString folded = FtpNameIndex::fold(text);
+    QVector<int> rows;
+    if (text.isEmpty()) {
+        rows.resize(_visibleRows);
+        std::iota(rows.begin(), rows.end(), 0);
+    } else {
+        // Уточнение фильтра ищет только среди уже найденных строк.
+        const bool narrowing = _filtering && folded.contains(_foldedFilter);
+        rows = _filterIndex.find(text, narrowing ? &_filtered : nullptr);
+    }
+    if (!_filtering) {
+        _filtered.resize(_visibleRows);
+        std::iota(_filtered.begin(), _filtered.end(), 0);
+        _filtering = true;
+    }
+    _filter = text;
+    _foldedFilter = folded;
+    showRows(rows);
+    if (text.isEmpty()) {
+        // Теперь _filtered совпадает с первыми _visibleRows строками.
+        _filtering = false;
+        _filtered.clear();
+    }
+    emit filterChanged();
+}
+
+void FtpModel::showRows(const QVector<int> &rows)
+{
+    // Сливаем старый и новый наборы: что пропало - удаляем, что
+    // появилось - вставляем, непрерывными диапазонами.
+    QVector<bool> keep(_filtered.size(), false);
+    QVector<bool> added(rows.size(), true);
+    int removeRanges = 0;
+    int insertRanges = 0;
+    for (int i = 0, j = 0; i < _filtered.size() || j < rows.size();) {
+        if (j == rows.size() || (i < _filtered.size() && _filtered.at(i) < rows.at(j))) {
+            removeRanges += i == 0 || keep.at(i - 1) ? 1 : 0;
+            ++i;
+        } else if (i == _filtered.size() || rows.at(j) < _filtered.at(i)) {
+            insertRanges += j == 0 || !added.at(j - 1) ? 1 : 0;
+            ++j;
+        } else {
+            keep[i++] = true;
+            added[j++] = false;
+        }
+    }
+    // Если диапазонов много, сброс дешевле для представлений.
+    if (removeRanges + insertRanges > 64) {
+        beginResetModel();
+        _filtered = rows;
+        endResetModel();
+        return;
+    }
+
+    for (int last = _filtered.size() - 1; last >= 0;) {
+        if (keep.at(last)) {
+            --last;
+            continue;
+        }
+        int first = last;
+        while (first > 0 && !keep.at(first - 1)) {
+            --first;
+        }
+        beginRemoveRows(QModelIndex(), first, last);
+        _filtered.remove(first, last - first + 1);
+        endRemoveRows();
+        last = first - 1;
+    }
+    for (int j = 0; j < rows.size();) {
+        if (!added.at(j)) {
+            ++j;
+            continue;
+        }
+        int last = j;
+        while (last + 1 < rows.size() && added.at(last + 1)) {
+            ++last;
+        }
+        beginInsertRows(QModelIndex(), j, last);
+        _filtered.insert(j, last - j + 1, 0);
+        std::copy(rows.cbegin() + j, rows.cbegin() + last + 1, _filtered.begin() + j);
+        endInsertRows();
+        j = last + 1;
+    }
+}
+
+void FtpModel::rebuildFilterIndex()
+{
+    _filterIndex.clear();
+    _filterIndex.reserve(_rows.size());
+    for (const auto &row : qAsConst(_rows)) {
+        _filterIndex.append(row.entry.name());
+    }
+}
+
+int FtpModel::listCacheSize() const
+{
+    return _listCache.maxCost();
+}
+
+void FtpModel::setListCacheSize(int directories)
+{
+    _listCache.setMaxCost(qMax(0, directories));
+}
+
+int FtpModel::listCacheTtl() const
+{
+    return _listCacheTtl;
+}
+
+void FtpModel::setListCacheTtl(int msec)
+{
+    _listCacheTtl = qMax(0, msec);
+}
+
+bool FtpModel::cacheRefresh() const
+{
+    return _cacheRefresh;
+}
+
+void FtpModel::setCacheRefresh(bool enabled)
+{
+    _cacheRefresh = enabled;
+}
+
+void FtpModel::clearListCache()
+{
+    _listCache.clear();
+}
+
+bool FtpModel::openListingStore(const QString &fileName)
+{
+    _storeStale.clear();
+    if (!_store.open(fileName)) {
+        qDebug() << __FILE__ << __LINE__ << this << _store.errorString();
+        return false;
+    }
+    // Уже показанный листинг не подменяем.
+    if (_rows.isEmpty() && _pendingRows.isEmpty() && _lastCommand.command != QFtp::List) {
+        showCachedListing();
+    }
+    return true;
+}
+
+bool FtpModel::saveListingStore(const QString &fileName)
+{
+    flushPendingRows();
+    QVector<FtpListingStore::Directory> dirs;
+    QSet<QString> saved;
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    const auto keys = _listCache.keys();
+    for (const auto &key : keys) {
+        const ListCacheEntry *cached = _listCache.object(key);
+        dirs.append({key, now - (_clock.elapsed() - cached->stamp) / 1000, cached->entries});
+        saved.insert(key);
+    }
+    // Текущий листинг, если кэш выключен или ещё не получил его.
+    const QString current = path();
+    if (!saved.contains(current) && _listedDir == current + QLatin1Char('\n')
+            && !_refreshing && _lastCommand.command != QFtp::List) {
+        FtpListingStore::Directory dir {current, now, {}};
+        dir.entries.reserve(_rows.size());
+        for (const auto &row : qAsConst(_rows)) {
+            dir.entries.append(row.entry);
+        }
+        dirs.append(dir);
+        saved.insert(current);
+    }
+    for (int i = 0; i < _store.directoryCount(); ++i) {
+        const QString dirPath = _store.path(i).toString();
+        if (!saved.contains(dirPath) && !_storeStale.contains(dirPath)) {
+            dirs.append(_store.directory(i));
+        }
+    }
+    // Отображённый файл заменяется, отпускаем его до записи.
+    _store.close();
+    _storeStale.clear();
+    QString error;
+    if (!FtpListingStore::write(fileName, _host, dirs, &error)) {
+        qDebug() << __FILE__ << __LINE__ << this << error;
+        return false;
+    }
+    return _store.open(fileName);
+}
+
+void FtpModel::closeListingStore()
+{
+    _store.close();
+    _storeStale.clear();
+}
+
+QVector<FtpDirEntry> FtpModel::listedEntries() const
+{
+    QVector<FtpDirEntry> entries;
+    entries.reserve(_rows.size());
+    for (const auto &row : qAsConst(_rows)) {
+        entries.append(row.entry);
+    }
+    return entries;
+}
+
+void FtpModel::storeListing()
+{
+    cacheListing(path(), listedEntries());
+}
+
+int FtpModel::watchInterval() const
+{
+    return _watching ? _watcher.minInterval() : 0;
+}
+
+void FtpModel::setWatchInterval(int minMsec, int maxMsec)
+{
+    _watching = minMsec > 0;
+    if (!_watching) {
+        _watcher.stop();
+        return;
+    }
+    _watcher.setInterval(minMsec, maxMsec);
+    // Каталог уже показан (хотя бы из кэша) - наблюдаем сразу, иначе
+    // после листинга. Устаревший кэш первый же опрос и поправит.
+    if (_listedDir == path() + QLatin1Char('\n') && !_refreshing
+            && _lastCommand.command != QFtp::List) {
+        _watcher.setPath(path(), listedEntries());
+        _watcher.start();
+    }
+}
+
+bool FtpModel::cacheListing(const QString &key, const QVector<FtpDirEntry> &entries)
+{
+    if (_listCacheTtl == 0 || _listCache.maxCost() == 0) {
+        return false;
+    }
+    return _listCache.insert(key, new ListCacheEntry {entries, _clock.elapsed()});
+}
+
+bool FtpModel::isListingCached(const QString &key) const
+{
+    const ListCacheEntry *cached = _listCache.object(key);
+    return cached && _clock.elapsed() - cached->stamp <= _listCacheTtl;
+}
+
+bool FtpModel::prefetchEnabled() const
+{
+    return _prefetchEnabled;
+}
+
+void FtpModel::setPrefetchEnabled(bool enabled)
+{
+    _prefetchEnabled = enabled;
+    if (!enabled) {
+        _prefetcher.stop();
+    }
+}
+
+int FtpModel::prefetchCount() const
+{
+    return _prefetchCount;
+}
+
+void FtpModel::setPrefetchCount(int count)
+{
+    _prefetchCount = qMax(0, count);
+}
+
+qint64 FtpModel::prefetchBudget() const
+{
+    return _prefetcher.maxBytes();
+}
+
+void FtpModel::setPrefetchBudget(qint64 bytes)
+{
+    _prefetcher.setMaxBytes(bytes);
+}
+
+void FtpModel::prefetch(const QString &name)
+{
+    if (!_prefetchEnabled || _listCacheTtl == 0 || _listCache.maxCost() == 0) {
+        return;
+    }
+    const QString key = absolutePath(name);
+    if (!isListingCached(key)) {
+        _prefetcher.enqueue(key, true);
+    }
+}
+
+void FtpModel::schedulePrefetch()
+{
+    // Очередь прошлого каталога больше не нужна.
+    _prefetcher.clear();
+    if (!_prefetchEnabled || _listCacheTtl == 0 || _listCache.maxCost() == 0) {
+        return;
+    }
+    // Не больше, чем поместится в кэш рядом с текущим каталогом.
+    const int limit = qMin(_prefetchCount, _listCache.maxCost() - 1);
+    int queued = 0;
+    for (int i = 0; i < _rows.size() && queued < limit; ++i) {
+        const FtpDirEntry &entry = _rows.at(i).entry;
+        if (!entry.isDir() || entry.name() == QLatin1String(".") || entry.name() == QLatin1String("..")) {
+            continue;
+        }
+        const QString key = absolutePath(entry.name());
+        if (!isListingCached(key)) {
+            _prefetcher.enqueue(key);
+        }
+        ++queued;
+    }
+}
+
+bool FtpModel::showCachedListing()
+{
+    const QString key = path();
+    const ListCacheEntry *cached = _listCache.object(key);
+    if (cached && _clock.elapsed() - cached->stamp > _listCacheTtl) {
+        _listCache.remove(key);
+        cached = nullptr;
+    }
+    QVector<FtpDirEntry> entries;
+    if (cached) {
+        entries = cached->entries;
+    } else {
+        // Нет в кэше - берём последнее известное состояние из снимка.
+        const int dir = _storeStale.contains(key) ? -1 : _store.indexOf(key);
+        if (dir < 0) {
+            return false;
+        }
+        entries = _store.entries(dir);
+    }
+    // Один сброс модели на всё: очистку, заполнение и сортировку, чтобы
+    // представления теряли выделение и прокрутку один раз.
+    beginResetModel();
+    dropRows();
+    _rows.reserve(entries.size());
+    if (_sorted) {
+        const QVector<int> order = _sorter.sort(entries);
+        for (int i : order) {
+            _rows.push_back({entries.at(i)});
+        }
+    } else {
+        for (const auto &entry : qAsConst(entries)) {
+            _rows.push_back({entry});
+        }
+    }
+    _visibleRows = _fetchPageSize > 0 ? qMin(_rows.size(), _fetchPageSize) : _rows.size();
+    indexRows(0);
+    if (_filterIndexEnabled) {
+        rebuildFilterIndex();
+    }
+    if (_filtering) {
+        _filtered = _filterIndex.find(_filter);
+    }
+    endResetModel();
+    _listedDir = key + QLatin1Char('\n');
+    _fromCache = true;
+    return true;
+}
+
+void FtpModel::invalidateListing(const QString &dirPath)
+{
+    const QString key = QDir::cleanPath(dirPath);
+    _listCache.remove(key);
+    if (_store.isOpen()) {
+        _storeStale.insert(key);
+    }
+}
+
+void FtpModel::flushPendingRows()
+{
+    _flushTimer.stop();
+    if (_pendingRows.isEmpty()) {
+        return;
+    }
+    // Строки листинга, а не добавленные обновлением или наблюдением.
+    const bool listed = _lastCommand.command == QFtp::List && !_refreshing;
+    QVector<FtpDirEntry> added;
+    added.swap(_pendingRows);
+    const int first = _rows.size();
+    if (_rows.capacity() < first + added.size()) {
+        _rows.reserve(qMax(first + added.size(), qMax(_expectedRows, first * 2)));
+    }
+    for (const auto &entry : qAsConst(added)) {
+        _rows.push_back({entry});
+    }
+    indexRows(first);
+    if (_filterIndexEnabled) {
+        for (int i = first; i < _rows.size(); ++i) {
+            _filterIndex.append(_rows.at(i).entry.name());
+        }
+    }
+    if (_filtering) {
+        QVector<int> matched;
+        for (int i = first; i < _rows.size(); ++i) {
+            if (_filterIndex.matches(i, _foldedFilter)) {
+                matched.append(i);
+            }
+        }
+        if (!matched.isEmpty()) {
+            beginInsertRows(QModelIndex(), _filtered.size(), _filtered.size() + matched.size() - 1);
+            _filtered += matched;
+            endInsertRows();
+        }
+    }
+    // Сразу показываем только первую страницу, дальше - по fetchMore().
+    exposeRows(_fetchPageSize > 0 ? qMax(_visibleRows, _fetchPageSize) : _rows.size());
+    // Подписчики listInfo() уже находят строки в модели.
+    if (listed) {
+        emitListInfo(added);
+    }
+}
+
+void FtpModel::indexRows(int from)
+{
+    // Записи строк с номером не меньше from должны быть уже удалены.
+    if (from == 0) {
+        _nameIndex.clear();
+        _nameIndex.reserve(_rows.size());
+    }
+    for (int i = from; i < _rows.size(); ++i) {
+        // При повторе имени, как и прежний линейный поиск, берём первую строку.
+        if (!_nameIndex.contains(_rows.at(i).entry.name())) {
+            _nameIndex.insert(_rows.at(i).entry.name(), i);
+        }
+    }
+}
+
 int FtpModel::setProxy(const QString &host, quint16 port)
 {
     auto c = _ftp->setProxy(host, port);
     _commandsQueue[c] = {QFtp::Command::SetProxy, {host}};
+    _prefetcher.setProxy(host, port);
     return c;
 }
 
 int FtpModel::connectToHost(const QString &host, quint16 port)
 {
     auto c = _ftp->connectToHost(host, port);
-    _commandsQueue[c] = {QFtp::Command::ConnectToHost, {host}};
+    _commandsQueue[c] = {QFtp::Command::ConnectToHost, {host, QString::number(port)}};
     return c;
 }
 
@@ -149,6 +1027,8 @@ int FtpModel::get(const QString &file, QIODevice *dev, QFtp::TransferType type)
 {
     auto c = _ftp->get(file, dev, type);
     _commandsQueue[c] = {QFtp::Command::Get, {file}};
+    // Путь фиксируем сейчас: к началу загрузки каталог может смениться.
+    _transfers[c].path = absolutePath(file);
     return c;
 }
 
@@ -218,6 +1098,8 @@ bool FtpModel::hasPendingCommands() const
 
 void FtpModel::clearPendingCommands()
 {
+    _commandsQueue.clear();
+    dropQueuedTransfers();
     return _ftp->clearPendingCommands();
 }
 
@@ -251,20 +1133,28 @@ QString FtpModel::path() const
 void FtpModel::abort()
 {
     _commandsQueue.clear();
+    dropQueuedTransfers();
+    // Быстрый abort очередь QFtp сохраняет, а здесь отменяется всё.
+    _ftp->clearPendingCommands();
     return _ftp->abort();
 }
 
-void FtpModel::timerEvent(QTimerEvent *event)
+void FtpModel::setStallDetection(qint64 minBytesPerSecond, int windowMsecs)
 {
-    qDebug() << __FILE__ << __LINE__;
-    Q_ASSERT(event->timerId() == _getTimerId);
-    // Завершить загрузку. Считать зависшим!
-    killTimer(_getTimerId);
-    _getTimerId = -1;
-    abort();
-    setFreeze(true);
-//    commandFinishedSlot(-1, true);
-//    doneSlot(true);
+    _ftp->setStallDetection(minBytesPerSecond, windowMsecs);
+}
+
+bool FtpModel::freeze() const
+{
+    return _freeze;
+}
+
+void FtpModel::setFreeze(bool newFreeze)
+{
+    if (_freeze == newFreeze)
+        return;
+    _freeze = newFreeze;
+    emit freezeChanged();
 }
 
 void FtpModel::stateChangedSlot(QFtp::State state)
@@ -280,12 +1170,49 @@ void FtpModel::stateChangedSlot(QFtp::State state)
     }
 }
 
-void FtpModel::listInfoSlot(const QUrlInfo &info)
+void FtpModel::listEntryBatchSlot(const QVector<FtpDirEntry> &entries)
 {
-    beginInsertRows(QModelIndex(), _rows.size(), _rows.size());
-    _rows.push_back({info});
-    endInsertRows();
-    emit listInfo(info);
+    if (entries.isEmpty()) {
+        return;
+    }
+    // Копим строки и вставляем их одним beginInsertRows на итерацию цикла
+    // событий, чтобы представления не перестраивались на каждый блок.
+    if (_refreshing) {
+        _refreshRows += entries;
+    } else {
+        _pendingRows += entries;
+        if (_pendingRows.size() >= _insertBatchSize) {
+            flushPendingRows();
+        } else if (!_flushTimer.isActive()) {
+            _flushTimer.start();
+        }
+    }
+}
+
+void FtpModel::emitListInfo(const QVector<FtpDirEntry> &entries)
+{
+    if (entries.isEmpty()) {
+        return;
+    }
+    // QUrlInfo собираем, только если на них кто-то подписан.
+    static const QMetaMethod listInfoSignal = QMetaMethod::fromSignal(&FtpModel::listInfo);
+    static const QMetaMethod listInfoBatchSignal = QMetaMethod::fromSignal(&FtpModel::listInfoBatch);
+    const bool wantInfo = isSignalConnected(listInfoSignal);
+    const bool wantBatch = isSignalConnected(listInfoBatchSignal);
+    if (!wantInfo && !wantBatch) {
+        return;
+    }
+    QVector<QUrlInfo> infos;
+    infos.reserve(entries.size());
+    for (const auto &entry : entries) {
+        infos.append(entry.toUrlInfo());
+        if (wantInfo) {
+            emit listInfo(infos.last());
+        }
+    }
+    if (wantBatch) {
+        emit listInfoBatch(infos);
+    }
 }
 
 void FtpModel::readyReadSlot()
@@ -295,16 +1222,23 @@ void FtpModel::readyReadSlot()
 
 void FtpModel::dataTransferProgressSlot(qint64 done, qint64 total)
 {
-    if (_getTimerId == -1) {
-        qDebug() << __LINE__ << "wow";
-        return;
+    auto it = _transfers.find(_currentTransfer);
+    if (it != _transfers.end()) {
+        // Скорость считаем по окну и сглаживаем, чтобы не скакала между блоками.
+        const qint64 elapsed = _transferClock.elapsed();
+        if (elapsed >= _RATE_WINDOW && done >= _rateBaseDone) {
+            const double rate = (done - _rateBaseDone) * 1000.0 / elapsed;
+            it->rate = it->rate > 0 ? it->rate * 0.7 + rate * 0.3 : rate;
+            _rateBaseDone = done;
+            _transferClock.restart();
+        }
+        it->done = done;
+        it->total = total;
+        _dirtyTransfers.insert(_currentTransfer);
+        if (!_progressTimer.isActive()) {
+            _progressTimer.start();
+        }
     }
-    killTimer(_getTimerId);
-    _getTimerId = startTimer(_GET_TIMEOUT);
-    _rows[_getRowIndex].done = done;
-    _rows[_getRowIndex].total = total;
-    emit dataChanged(index(_getRowIndex, 0), index(_getRowIndex, 0),
-                     {FtpProgressDoneRole, FtpProgressTotalRole});
 
     emit dataTransferProgress(done, total);
 }
@@ -320,23 +1254,35 @@ void FtpModel::commandStartedSlot(int id)
     Q_ASSERT(_commandsQueue.firstKey() == id);
 
     _lastCommand = _commandsQueue[id];
+    // Пока основное соединение занято, запасное не начинает новых чтений.
+    _prefetcher.setPaused(true);
     switch(_lastCommand.command) {
     case QFtp::List: {
-        beginResetModel();
-        _rows.clear();
-        endResetModel();
+        const QString dir = path() + QLatin1Char('\n') + _lastCommand.params.value(0);
+        if ((_diffRefresh || _fromCache) && dir == _listedDir && !_rows.isEmpty()) {
+            flushPendingRows();
+            _refreshing = true;
+            _refreshRows.clear();
+            _refreshRows.reserve(_rows.size());
+        } else {
+            clearRows();
+        }
+        _listedDir = dir;
+        _fromCache = false;
         break;
     }
     case QFtp::Get: {
-        _getRowIndex = findName(_lastCommand.params.at(0));
-        Q_ASSERT(_getRowIndex >= 0);
-        _rows[_getRowIndex].state = FileState::Downloading;
-        if (_getTimerId == -1) {
-            qDebug() << __LINE__ << "wow";
-            return;
-        }
-        _getTimerId = startTimer(_GET_TIMEOUT);
-        emit dataChanged(index(_getRowIndex, 0), index(_getRowIndex, 0), {FtpFileStateRole});
+        _currentTransfer = id;
+        Transfer &transfer = _transfers[id];
+        if (transfer.path.isEmpty()) {
+            transfer.path = absolutePath(_lastCommand.params.at(0));
+        }
+        transfer.state = FileState::Downloading;
+        _transferClock.start();
+        _rateBaseDone = 0;
+        setFreeze(false);
+        updateTransferRow(transfer, {FtpFileStateRole});
+        emit transferChanged(id);
         break;
     }
     case QFtp::None:
@@ -361,58 +1307,136 @@ void FtpModel::commandStartedSlot(int id)
 
 void FtpModel::commandFinishedSlot(int id, bool error)
 {
+    flushPendingRows();
     qDebug() << __FILE__ << __LINE__ << this << _lastCommand.command << id << error;
     if (error) {
         qDebug() << "lastCommand = " << _lastCommand.command << ": " << _ftp->errorString();
-        _commandsQueue.clear();
+        // Обычная ошибка очищает очередь QFtp, быстрый abort - нет.
+        if (!_ftp->hasPendingCommands()) {
+            _commandsQueue.clear();
+            dropQueuedTransfers();
+        }
         emit errorChanged();
     }
     switch(_lastCommand.command) {
     case QFtp::ConnectToHost: {
+        // Пути другого сервера в кэше не нужны.
+        _listCache.clear();
+        _prefetcher.setSession(QString(), 21, QString(), QString());
+        _watcher.stop();
+        _watcher.setSession(QString(), 21, QString(), QString());
+        _host = error ? QString() : _lastCommand.params.at(0);
+        _port = _lastCommand.params.at(1).toUShort();
+        if (_store.isOpen() && _store.host() != _host) {
+            // Снимок чужого сервера; показанные из него строки тоже убираем.
+            closeListingStore();
+            if (_fromCache) {
+                _fromCache = false;
+                _listedDir.clear();
+                clearRows();
+            }
+        }
         _path.clear();
         _path.append("");
         emit pathChanged();
         break;
     }
     case QFtp::Close: {
+        _prefetcher.setSession(QString(), 21, QString(), QString());
+        _watcher.stop();
+        _watcher.setSession(QString(), 21, QString(), QString());
         _path.clear();
         emit pathChanged();
-        beginResetModel();
-        _rows.clear();
-        endResetModel();
+        clearRows();
         break;
     }
     case QFtp::Cd: {
         _path.append(_lastCommand.params.at(0));
         emit pathChanged();
+        // Показываем каталог из кэша и, если просили и листинг ещё не
+        // заказан, перечитываем его сами.
+        if (!error && showCachedListing() && _cacheRefresh) {
+            const bool listQueued = std::any_of(_commandsQueue.cbegin(), _commandsQueue.cend(),
+                                                [](const CommandQueue &c) { return c.command == QFtp::List; });
+            if (!listQueued) {
+                emit cacheRefreshQueued(list());
+            }
+        }
         break;
     }
     case QFtp::Get: {
-        killTimer(_getTimerId);
-        if (_getTimerId == -1) {
-            qDebug() << __LINE__ << "wow";
-        }
-        _getTimerId = 0;
-        _getRowIndex = findName(_lastCommand.params.at(0));
-        _rows[_getRowIndex].state = error ? FileState::Failed : FileState::Downloaded;
-        emit dataChanged(index(_getRowIndex, 0), index(_getRowIndex, 0), {FtpFileStateRole});
+        // Последний прогресс показываем до смены состояния.
+        flushProgress();
+        _currentTransfer = 0;
+        setFreeze(error && _ftp->hasStalled());
+        auto it = _transfers.find(id);
+        if (it == _transfers.end()) {
+            break;
+        }
+        it->state = error ? FileState::Failed : FileState::Downloaded;
+        updateTransferRow(*it, {FtpFileStateRole});
+        emit transferChanged(id);
+        _transfers.erase(it);
+        break;
+    }
+    case QFtp::List: {
+        if (_refreshing) {
+            // При ошибке оставляем прежний листинг.
+            if (error) {
+                _refreshing = false;
+                _refreshRows.clear();
+            } else {
+                applyRefresh();
+            }
+        } else if (_sorted) {
+            applySort(_sorter);
+        }
+        if (!error && _lastCommand.params.value(0).isEmpty()) {
+            storeListing();
+            schedulePrefetch();
+            if (_watching) {
+                _watcher.setPath(path(), listedEntries());
+                _watcher.start();
+            }
+        }
+        break;
+    }
+    case QFtp::Remove:
+    case QFtp::Rmdir: {
+        // Содержимое текущего каталога изменилось, удалённого - пропало.
+        if (!error) {
+            invalidateListing(path());
+            if (_lastCommand.command == QFtp::Rmdir) {
+                invalidateListing(path() + QLatin1Char('/') + _lastCommand.params.at(0));
+            }
+        }
+        break;
+    }
+    case QFtp::Put:
+    case QFtp::Mkdir:
+    case QFtp::Rename: {
+        // Содержимое текущего каталога изменилось.
+        if (!error) {
+            invalidateListing(path());
+        }
+        break;
+    }
+    case QFtp::Login: {
+        if (!error && !_host.isEmpty()) {
+            _prefetcher.setSession(_host, _port, _lastCommand.params.at(0), _lastCommand.params.at(1));
+            _watcher.setSession(_host, _port, _lastCommand.params.at(0), _lastCommand.params.at(1));
+        }
         break;
     }
-    case QFtp::List:
     case QFtp::None:
     case QFtp::SetTransferMode:
     case QFtp::SetProxy:
-    case QFtp::Login:
-    case QFtp::Put:
-    case QFtp::Remove:
-    case QFtp::Mkdir:
-    case QFtp::Rmdir:
-    case QFtp::Rename:
     case QFtp::RawCommand:
         break;
 
     }
     _lastCommand = QFtp::None;
+    _prefetcher.setPaused(_ftp->hasPendingCommands());
     emit commandFinished(id, error);
 }
 
@@ -422,17 +1446,44 @@ void FtpModel::doneSlot(bool error)
     emit done(error);
 }
 
-bool FtpModel::freeze() const
+void FtpModel::watchChangedSlot(const QVector<FtpDirEntry> &added, const QVector<FtpDirEntry> &removed,
+                                const QVector<FtpDirEntry> &modified)
 {
-    return _freeze;
+    // Идёт свой листинг или показан уже другой каталог - изменения
+    // придут с листингом.
+    if (_watcher.path() != path() || _refreshing || _lastCommand.command == QFtp::List) {
+        return;
+    }
+    flushPendingRows();
+    for (const auto &entry : removed) {
+        const int row = findName(entry.name());
+        if (row >= 0) {
+            removeRowAt(row);
+        }
+    }
+    for (const auto &entry : modified) {
+        const int row = findName(entry.name());
+        if (row >= 0) {
+            _rows[row].entry = entry;
+            emitRowsChanged(row, row);
+        }
+    }
+    if (!added.isEmpty()) {
+        _pendingRows += added;
+        flushPendingRows();
+        if (_sorted) {
+            applySort(_sorter);
+        }
+    }
+    storeListing();
 }
 
-void FtpModel::setFreeze(bool newFreeze)
+void FtpModel::prefetchedSlot(const QString &dirPath, const QVector<FtpDirEntry> &entries)
 {
-    if (_freeze == newFreeze)
-        return;
-    _freeze = newFreeze;
-    emit freezeChanged();
+    // Свежий листинг, прочитанный основным соединением, не перетираем.
+    if (!isListingCached(dirPath)) {
+        cacheListing(dirPath, entries);
+    }
 }
 
 const QVector<FtpModel::RowStruct> &FtpModel::files() const
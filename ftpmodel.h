@@ -1,8 +1,18 @@
 #pragma once
 
 #include <QAbstractTableModel>
+#include <QCache>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QTimer>
 #include <qurlinfo.h>
 #include <qftp.h>
+#include <ftpdirentry.h>
+#include <ftpdirwatcher.h>
+#include <ftplistingstore.h>
+#include <ftplistsorter.h>
+#include <ftpnameindex.h>
+#include <ftpprefetcher.h>
 
 class FtpModelPrivate;
 
@@ -11,6 +21,7 @@ class FtpModel : public QAbstractTableModel
     Q_OBJECT
     Q_PROPERTY(QString path READ path NOTIFY pathChanged FINAL)
     Q_PROPERTY(int rowCount READ rowCount NOTIFY rowCountChanged FINAL)
+    Q_PROPERTY(QString filter READ filter WRITE setFilter NOTIFY filterChanged FINAL)
 public:
 
     enum class FileState {
@@ -37,21 +48,128 @@ public:
     static const std::array<QString, FTP_ROLE_COUNT> FTP_ROLE_STR;
 
     struct RowStruct {
-        QUrlInfo info;
+        FtpDirEntry entry;
         FileState state = FileState::None;
         qint64 done = 0;
         qint64 total = 1;
+
+        QUrlInfo info() const { return entry.toUrlInfo(); }
+    };
+
+    // Состояние загрузки, заказанной через get().
+    struct Transfer {
+        // Полный путь файла на сервере.
+        QString path;
+        FileState state = FileState::None;
+        qint64 done = 0;
+        qint64 total = 1;
+        // Сглаженная скорость, байт/с.
+        double rate = 0;
     };
 
     FtpModel(QObject *parent = nullptr);
     FtpModel(bool isTable, QObject *parent = nullptr);
 
-    int findName(QString name) const;
+    int findName(const QString &name) const;
+
+    // Загрузки по идентификатору команды get(), от постановки в очередь
+    // до завершения.
+    QList<int> transfers() const;
+    Transfer transfer(int id) const;
+    // Строка файла загрузки в текущем листинге или -1.
+    int transferRow(int id) const;
+
+    // Прогресс загрузок копится и отдаётся представлениям не чаще
+    // progressRate() раз в секунду, смежные строки - одним dataChanged.
+    int progressRate() const;
+    void setProgressRate(int hz);
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
     QHash<int, QByteArray> roleNames() const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+    // Сортировка по ключу, в том числе по времени, которого нет среди колонок.
+    void sortBy(FtpListSorter::SortKey key, Qt::SortOrder order = Qt::AscendingOrder);
+    FtpListSorter::Options sortOptions() const;
+    void setSortOptions(FtpListSorter::Options options);
+
+    // Строки листинга копятся и вставляются пачкой: на следующей итерации
+    // цикла событий или сразу, как наберётся insertBatchSize строк.
+    int insertBatchSize() const;
+    void setInsertBatchSize(int size);
+
+    // Представлениям строки отдаются страницами по fetchPageSize() через
+    // fetchMore(), остальные хранятся в files(). 0 (по умолчанию) - отдавать
+    // все сразу; со страницами rowCount - только показанные строки.
+    int fetchPageSize() const;
+    void setFetchPageSize(int size);
+
+    // Повторный листинг того же каталога не сбрасывает модель, а
+    // сравнивается с текущими строками по имени: изменённые строки
+    // обновляются, лишние удаляются, новые добавляются.
+    bool diffRefresh() const;
+    void setDiffRefresh(bool enabled);
+
+    // Фильтр по подстроке имени без учёта регистра. Представлениям видны
+    // только подходящие строки; смена фильтра сообщается вставками и
+    // удалениями, а не сбросом модели. Индекс имён строится при первом
+    // фильтре и дальше поддерживается вместе со строками.
+    QString filter() const;
+    void setFilter(const QString &text);
+
+    // Кэш листингов по пути. После cd() закэшированные строки показываются
+    // сразу. Записи старше listCacheTtl() мс не показываются; 0 отключает кэш.
+    int listCacheSize() const;
+    void setListCacheSize(int directories);
+    int listCacheTtl() const;
+    void setListCacheTtl(int msec);
+    void clearListCache();
+    // С cacheRefresh() показанный из кэша каталог, если листинг ещё не
+    // заказан, модель перечитывает сама и сравнивает с показанным.
+    // Номер этой команды сообщается сигналом cacheRefreshQueued() раньше
+    // её commandStarted(). По умолчанию выключено: команды в QFtp ставит
+    // только вызывающий.
+    bool cacheRefresh() const;
+    void setCacheRefresh(bool enabled);
+
+    // Снимок листингов на диске (см. FtpListingStore). Открытый снимок
+    // отображается в память и служит вторым уровнем кэша: каталог, которого
+    // нет в кэше, показывается из снимка (и с cacheRefresh() перечитывается).
+    // Сразу после открытия показывается сохранённый листинг текущего
+    // каталога, так что до подключения к серверу видно последнее известное
+    // состояние. Закрывает снимок closeListingStore(), clearListCache() его
+    // не трогает; снимок другого сервера закрывается при connectToHost().
+    // saveListingStore() пишет кэш, текущий листинг и ещё не устаревшие
+    // каталоги открытого снимка, после чего открывает записанный файл.
+    bool openListingStore(const QString &fileName);
+    bool saveListingStore(const QString &fileName);
+    void closeListingStore();
+
+    // Упреждающее чтение: после листинга первые prefetchCount()
+    // подкаталогов читаются на отдельном соединении и кладутся в кэш
+    // листингов, чтобы cd() в них показывал строки сразу. Основное
+    // соединение не используется, а пока на нём есть команды, новые
+    // чтения не начинаются. Листинги больше prefetchBudget() байт
+    // прерываются. prefetch() читает подкаталог вне очереди, например
+    // при наведении или выделении в представлении.
+    bool prefetchEnabled() const;
+    void setPrefetchEnabled(bool enabled);
+    int prefetchCount() const;
+    void setPrefetchCount(int count);
+    qint64 prefetchBudget() const;
+    void setPrefetchBudget(qint64 bytes);
+    Q_INVOKABLE void prefetch(const QString &name);
+
+    // Наблюдение за показанным каталогом на отдельном соединении (см.
+    // FtpDirWatcher): опрос раз в minMsec..maxMsec мс, найденные
+    // изменения применяются к строкам по одной, без сброса модели.
+    // 0 - выключено.
+    int watchInterval() const;
+    void setWatchInterval(int minMsec, int maxMsec = 60000);
 
     int setProxy(const QString &host, quint16 port);
     int connectToHost(const QString &host, quint16 port=21);
@@ -81,31 +199,67 @@ public:
 
     const QVector<RowStruct> &files() const;
 
-    bool freeze() const;
+    // Загрузка, скорость которой minBytesPerSecond байт/с держится ниже
+    // windowMsecs мс, прерывается и завершается с ошибкой.
+    void setStallDetection(qint64 minBytesPerSecond, int windowMsecs);
+
+    // Устарело: последняя загрузка прервана как зависшая (QFtp::hasStalled()).
+    // Сессия при этом остаётся, ждать переподключения не нужно.
+    Q_DECL_DEPRECATED bool freeze() const;
 
 public slots:
     void abort();
 
-protected:
-    void timerEvent(QTimerEvent *event) override;
-
 private:
     void setFreeze(bool newFreeze);
+    void applySort(const FtpListSorter &sorter);
+    void clearRows();
+    // Очистка строк без сигналов, внутри beginResetModel()/endResetModel().
+    void dropRows();
+    void removeRowAt(int row);
+    void removeRowRange(int first, int last);
+    void exposeRows(int count);
+    void emitRowsChanged(int first, int last, const QVector<int> &roles = QVector<int>());
+    int sourceRow(int viewRow) const;
+    int viewRow(int sourceRow) const;
+    void rebuildFilterIndex();
+    void showRows(const QVector<int> &rows);
+    QString absolutePath(const QString &file) const;
+    int rowOfPath(const QString &filePath) const;
+    int applyTransferRow(const Transfer &transfer);
+    void updateTransferRow(const Transfer &transfer, const QVector<int> &roles);
+    void flushProgress();
+    void dropQueuedTransfers();
+    void indexRows(int from);
+    void flushPendingRows();
+    void emitListInfo(const QVector<FtpDirEntry> &entries);
+    void applyRefresh();
+    QVector<FtpDirEntry> listedEntries() const;
+    void storeListing();
+    bool cacheListing(const QString &key, const QVector<FtpDirEntry> &entries);
+    bool isListingCached(const QString &key) const;
+    void schedulePrefetch();
+    bool showCachedListing();
+    void invalidateListing(const QString &dirPath);
 
 private slots:
     void stateChangedSlot(QFtp::State state);
-    void listInfoSlot(const QUrlInfo& info);
+    void listEntryBatchSlot(const QVector<FtpDirEntry>& entries);
     void readyReadSlot();
     void dataTransferProgressSlot(qint64 done, qint64 total);
     void rawCommandReplySlot(int replyCode, const QString& detail);
     void commandStartedSlot(int id);
     void commandFinishedSlot(int id, bool error);
     void doneSlot(bool error);
+    void prefetchedSlot(const QString &dirPath, const QVector<FtpDirEntry> &entries);
+    void watchChangedSlot(const QVector<FtpDirEntry> &added, const QVector<FtpDirEntry> &removed,
+                          const QVector<FtpDirEntry> &modified);
 
 signals:
     void rowCountChanged();
     void stateChanged(QFtp::State);
     void listInfo(const QUrlInfo&);
+    void listInfoBatch(const QVector<QUrlInfo>&);
     void readyRead();
     void dataTransferProgress(qint64, qint64);
     void rawCommandReply(int, const QString&);
@@ -115,9 +269,14 @@ signals:
 
     void errorChanged();
     void pathChanged();
+    void filterChanged();
+    void cacheRefreshQueued(int id);
 
+    // Устарело, см. freeze().
     void freezeChanged();
 
+    void transferChanged(int id);
+
 private:
     struct CommandQueue {
         CommandQueue(QFtp::Command c) : command(c) {}
@@ -132,17 +291,75 @@ private:
     bool _isTable = false;
     CommandQueue _lastCommand {};
     QVector<RowStruct> _rows;
+    // Сколько первых строк _rows видно представлениям.
+    int _visibleRows = 0;
+    int _fetchPageSize = 0;
+    // Пока _filtering, представлениям видны строки _filtered (номера
+    // строк _rows по возрастанию), а не первые _visibleRows.
+    bool _filtering = false;
+    QString _filter;
+    QString _foldedFilter;
+    QVector<int> _filtered;
+    FtpNameIndex _filterIndex;
+    bool _filterIndexEnabled = false;
+    // Индекс имя -> строка, поддерживается вместе с _rows.
+    QHash<QString, int> _nameIndex;
+    // Принятые, но ещё не вставленные строки листинга.
+    QVector<FtpDirEntry> _pendingRows;
+    QTimer _flushTimer;
+    int _insertBatchSize = 4096;
+    // Размер прошлого листинга, по нему резервируем _rows.
+    int _expectedRows = 0;
+    // Последняя применённая сортировка, повторяется после листинга.
+    FtpListSorter _sorter;
+    bool _sorted = false;
+    bool _diffRefresh = false;
+    bool _cacheRefresh = false;
+    // Идёт обновление: новый листинг собирается в _refreshRows.
+    bool _refreshing = false;
+    QVector<FtpDirEntry> _refreshRows;
+    // Каталог, листинг которого сейчас в модели.
+    QString _listedDir;
+
+    struct ListCacheEntry {
+        QVector<FtpDirEntry> entries;
+        qint64 stamp;
+    };
+    QCache<QString, ListCacheEntry> _listCache {32};
+    QElapsedTimer _clock;
+    int _listCacheTtl = 60000;
+    // Строки взяты из кэша, следующий листинг их только сверяет.
+    bool _fromCache = false;
+    FtpListingStore _store;
+    // Каталоги, изменившиеся после записи снимка.
+    QSet<QString> _storeStale;
+    FtpPrefetcher _prefetcher;
+    bool _prefetchEnabled = false;
+    int _prefetchCount = 8;
+    FtpDirWatcher _watcher;
+    bool _watching = false;
+    // Адрес основного соединения, для входа запасного.
+    QString _host;
+    quint16 _port = 21;
     QMap<int, CommandQueue> _commandsQueue;
     QFtp *_ftp;
     QStringList _path;
-    int _getRowIndex = -1;
-    int _getTimerId = 0;
-    // QFTP не отрабатывает abort (не вызываются сигналы окончания).
-    // Добавил костыль, если срабатывает сторожевой таймер, freeze
-    // выставляется true.
-    bool _freeze = false;
+    FtpListSorter::Options _sortOptions = FtpListSorter::NoOptions;
+    QHash<int, Transfer> _transfers;
+    // Выполняемая сейчас загрузка, 0 - нет.
+    int _currentTransfer = 0;
+    QElapsedTimer _transferClock;
+    qint64 _rateBaseDone = 0;
+    // Загрузки с ещё не показанным прогрессом.
+    QSet<int> _dirtyTransfers;
+    QTimer _progressTimer;
 
-    // Время сторожевого таймера на скачивание.
-    static constexpr int _GET_TIMEOUT = 30000;
+    // Последняя загрузка прервана как зависшая, для freeze().
+    bool _freeze = false;
+    // Зависание загрузки: скорость ниже _STALL_RATE байт/с дольше _STALL_WINDOW мс.
+    static constexpr qint64 _STALL_RATE = 1024;
+    static constexpr int _STALL_WINDOW = 10000;
+    // Окно усреднения скорости загрузки.
+    static constexpr int _RATE_WINDOW = 250;
 
 };
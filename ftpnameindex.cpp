@@ -0,0 +1,112 @@
+#include "ftpnameindex.h"
+
+#include <algorithm>
+
+quint64 FtpNameIndex::trigram(const QChar *p)
+{
+    return (quint64(p[0].unicode()) << 32) | (quint64(p[1].unicode()) << 16) | p[2].unicode();
+}
+
+void FtpNameIndex::clear()
+{
+    _names.clear();
+    _postings.clear();
+}
+
+void FtpNameIndex::reserve(int size)
+{
+    _names.reserve(size);
+}
+
+void FtpNameIndex::append(const QString &name)
+{
+    const int row = _names.size();
+    _names.append(fold(name));
+    const QString &folded = _names.last();
+    for (int i = 0; i + 3 <= folded.size(); ++i) {
+        QVector<int> &rows = _postings[trigram(folded.constData() + i)];
+        // Повтор триграммы в одном имени не дублирует строку.
+        if (rows.isEmpty() || rows.last() != row) {
+            rows.append(row);
+        }
+    }
+}
+
+void FtpNameIndex::remove(int first, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+    _names.remove(first, count);
+    for (auto it = _postings.begin(); it != _postings.end();) {
+        QVector<int> &rows = *it;
+        auto from = std::lower_bound(rows.begin(), rows.end(), first);
+        auto to = std::lower_bound(from, rows.end(), first + count);
+        from = rows.erase(from, to);
+        for (; from != rows.end(); ++from) {
+            *from -= count;
+        }
+        it = rows.isEmpty() ? _postings.erase(it) : it + 1;
+    }
+}
+
+bool FtpNameIndex::matches(int row, const QString &foldedNeedle) const
+{
+    return _names.at(row).contains(foldedNeedle);
+}
+
+QVector<int> FtpNameIndex::find(const QString &needle, const QVector<int> *within) const
+{
+    const QString folded = fold(needle);
+    QVector<int> result;
+
+    // Самый короткий список среди триграмм образца.
+    const QVector<int> *shortest = nullptr;
+    for (int i = 0; i + 3 <= folded.size(); ++i) {
+        const auto it = _postings.constFind(trigram(folded.constData() + i));
+        if (it == _postings.cend()) {
+            return result;
+        }
+        if (!shortest || it->size() < shortest->size()) {
+            shortest = &*it;
+        }
+    }
+
+    if (shortest && within && within->size() < shortest->size()) {
+        shortest = nullptr;
+    }
+    if (shortest) {
+        // Кандидаты из триграммы; с within - только их пересечение.
+        QVector<int>::const_iterator w;
+        if (within) {
+            w = within->cbegin();
+        }
+        for (int row : *shortest) {
+            if (within) {
+                w = std::lower_bound(w, within->cend(), row);
+                if (w == within->cend()) {
+                    break;
+                }
+                if (*w != row) {
+                    continue;
+                }
+            }
+            if (matches(row, folded)) {
+                result.append(row);
+            }
+        }
+    } else if (within) {
+        for (int row : *within) {
+            if (matches(row, folded)) {
+                result.append(row);
+            }
+        }
+    } else {
+        for (int row = 0; row < _names.size(); ++row) {
+            if (matches(row, folded)) {
+                result.append(row);
+            }
+        }
+    }
+    return result;
+}
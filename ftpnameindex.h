@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+// Индекс для поиска подстроки в именах без учёта регистра.
+// Имена хранятся уже в свёрнутом регистре, для каждой триграммы -
+// возрастающий список строк, где она встречается. Поиск берёт самый
+// короткий список из триграмм образца и проверяет только его строки.
+// Образцы короче трёх символов проверяются по всем именам, но без
+// повторной свёртки регистра.
+// Строки нумеруются как в модели: добавление в конец дешёвое,
+// удаление сдвигает номера следующих строк.
+class FtpNameIndex
+{
+public:
+    int size() const { return _names.size(); }
+    void clear();
+    void reserve(int size);
+    void append(const QString &name);
+    void remove(int first, int count);
+
+    // Строки по возрастанию, имена которых содержат needle. Если задан
+    // within (тоже по возрастанию), ищем только среди его строк: так
+    // уточнение уже введённого фильтра не трогает остальные имена.
+    QVector<int> find(const QString &needle, const QVector<int> *within = nullptr) const;
+    // Подходит ли строка row под образец, уже приведённый через fold().
+    bool matches(int row, const QString &foldedNeedle) const;
+
+    static QString fold(const QString &text) { return text.toCaseFolded(); }
+
+private:
+    static quint64 trigram(const QChar *p);
+
+    QVector<QString> _names;
+    QHash<quint64, QVector<int>> _postings;
+};
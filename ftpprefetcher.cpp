@@ -0,0 +1,182 @@
+#include "ftpprefetcher.h"
+
+#include <qftp.h>
+
+FtpPrefetcher::FtpPrefetcher(QObject *parent)
+    : QObject(parent)
+{
+    _idleTimer.setSingleShot(true);
+    _idleTimer.setInterval(60000);
+    connect(&_idleTimer, &QTimer::timeout, this, &FtpPrefetcher::stop);
+}
+
+void FtpPrefetcher::setSession(const QString &host, quint16 port, const QString &user, const QString &password)
+{
+    if (host != _host || port != _port || user != _user || password != _password) {
+        stop();
+    }
+    _host = host;
+    _port = port;
+    _user = user;
+    _password = password;
+    _failed = false;
+}
+
+void FtpPrefetcher::setProxy(const QString &host, quint16 port)
+{
+    if (host != _proxyHost || port != _proxyPort) {
+        stop();
+    }
+    _proxyHost = host;
+    _proxyPort = port;
+}
+
+qint64 FtpPrefetcher::maxBytes() const
+{
+    return _maxBytes;
+}
+
+void FtpPrefetcher::setMaxBytes(qint64 bytes)
+{
+    _maxBytes = bytes;
+}
+
+int FtpPrefetcher::idleTimeout() const
+{
+    return _idleTimer.interval();
+}
+
+void FtpPrefetcher::setIdleTimeout(int msec)
+{
+    _idleTimer.setInterval(msec);
+}
+
+void FtpPrefetcher::enqueue(const QString &path, bool urgent)
+{
+    if (path == _current) {
+        return;
+    }
+    const int i = _queue.indexOf(path);
+    if (i >= 0) {
+        if (!urgent) {
+            return;
+        }
+        _queue.removeAt(i);
+    }
+    if (urgent) {
+        _queue.prepend(path);
+    } else {
+        _queue.append(path);
+    }
+    startNext();
+}
+
+bool FtpPrefetcher::isQueued(const QString &path) const
+{
+    return path == _current || _queue.contains(path);
+}
+
+void FtpPrefetcher::clear()
+{
+    _queue.clear();
+}
+
+bool FtpPrefetcher::isPaused() const
+{
+    return _paused;
+}
+
+void FtpPrefetcher::setPaused(bool paused)
+{
+    _paused = paused;
+    startNext();
+}
+
+void FtpPrefetcher::stop()
+{
+    _queue.clear();
+    _current.clear();
+    _currentId = 0;
+    _entries.clear();
+    _idleTimer.stop();
+    if (_ftp) {
+        // Соединение не нужно, результатов его команд не ждём.
+        _ftp->disconnect(this);
+        _ftp->deleteLater();
+        _ftp = nullptr;
+    }
+}
+
+void FtpPrefetcher::startNext()
+{
+    if (_paused || _failed || _currentId != 0 || _queue.isEmpty() || _host.isEmpty()) {
+        return;
+    }
+    _idleTimer.stop();
+    if (!_ftp) {
+        _ftp = new QFtp(this);
+        _ftp->setFastAbort(true);
+        connect(_ftp, &QFtp::listEntryBatch, this, &FtpPrefetcher::listEntryBatchSlot);
+        connect(_ftp, &QFtp::commandFinished, this, &FtpPrefetcher::commandFinishedSlot);
+        if (!_proxyHost.isEmpty()) {
+            _ftp->setProxy(_proxyHost, _proxyPort);
+        }
+        _ftp->connectToHost(_host, _port);
+        _ftp->login(_user, _password);
+    }
+    _current = _queue.takeFirst();
+    _entries.clear();
+    _bytes = 0;
+    _overBudget = false;
+    _currentId = _ftp->list(_current);
+}
+
+void FtpPrefetcher::listEntryBatchSlot(const QVector<FtpDirEntry> &entries)
+{
+    if (_currentId == 0 || _overBudget) {
+        return;
+    }
+    _entries += entries;
+    // Прогресса для LIST QFtp не сообщает. Строка листинга Unix - имя,
+    // владелец, группа и около 48 байт прав, ссылок, размера и даты.
+    for (const auto &entry : entries) {
+        _bytes += entry.name().size() + entry.owner().size() + entry.group().size() + 48;
+    }
+    if (_maxBytes > 0 && _bytes > _maxBytes) {
+        // Слишком большой каталог не стоит канала, пусть читается по запросу.
+        _overBudget = true;
+        _entries.clear();
+        _ftp->abort();
+    }
+}
+
+void FtpPrefetcher::commandFinishedSlot(int id, bool error)
+{
+    if (id != _currentId) {
+        if (error) {
+            // Не удалось подключиться или войти.
+            _failed = true;
+            stop();
+        }
+        return;
+    }
+    const QString path = _current;
+    QVector<FtpDirEntry> entries;
+    entries.swap(_entries);
+    _current.clear();
+    _currentId = 0;
+    if (!error && !_overBudget) {
+        emit listed(path, entries);
+    } else if (error && _ftp->state() == QFtp::Unconnected) {
+        // Соединение потеряно, откроем заново при следующем enqueue().
+        _queue.clear();
+        _ftp->disconnect(this);
+        _ftp->deleteLater();
+        _ftp = nullptr;
+        return;
+    }
+    if (_queue.isEmpty()) {
+        _idleTimer.start();
+    }
+    startNext();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <ftpdirentry.h>
+
+class QFtp;
+
+// Фоновое чтение листингов каталогов на отдельном соединении.
+// Команды пользователя идут по своему QFtp и никогда не ждут этого.
+// Бюджет: одно соединение, один LIST за раз, не больше maxBytes()
+// байт на листинг (больший прерывается и отбрасывается; размер
+// оценивается по разобранным записям). Простаивающее
+// соединение закрывается через idleTimeout() мс.
+class FtpPrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FtpPrefetcher(QObject *parent = nullptr);
+
+    // Параметры входа для запасного соединения.
+    void setSession(const QString &host, quint16 port, const QString &user, const QString &password);
+    // Прокси основного соединения (QFtp::setProxy()), пустой host - без него.
+    void setProxy(const QString &host, quint16 port);
+
+    qint64 maxBytes() const;
+    void setMaxBytes(qint64 bytes);
+    int idleTimeout() const;
+    void setIdleTimeout(int msec);
+
+    // Поставить каталог в очередь; urgent - в начало (наведение, выделение).
+    void enqueue(const QString &path, bool urgent = false);
+    bool isQueued(const QString &path) const;
+    // Убрать ещё не начатые каталоги.
+    void clear();
+    // Пока на паузе, новые LIST не начинаются.
+    bool isPaused() const;
+    void setPaused(bool paused);
+    // Прервать всё и закрыть соединение.
+    void stop();
+
+signals:
+    void listed(const QString &path, const QVector<FtpDirEntry> &entries);
+
+private slots:
+    void listEntryBatchSlot(const QVector<FtpDirEntry> &entries);
+    void commandFinishedSlot(int id, bool error);
+
+private:
+    void startNext();
+
+    QFtp *_ftp = nullptr;
+    QString _host;
+    quint16 _port = 21;
+    QString _user;
+    QString _password;
+    QString _proxyHost;
+    quint16 _proxyPort = 0;
+    // Вход не удался: до новой setSession() не пытаемся.
+    bool _failed = false;
+
+    QStringList _queue;
+    QString _current;
+    int _currentId = 0;
+    QVector<FtpDirEntry> _entries;
+    // Примерный размер прочитанного листинга.
+    qint64 _bytes = 0;
+    bool _overBudget = false;
+    bool _paused = false;
+    qint64 _maxBytes = 4 * 1024 * 1024;
+    QTimer _idleTimer;
+};
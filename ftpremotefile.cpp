@@ -0,0 +1,569 @@
+#include "ftpremotefile.h"
+
+#include <QEventLoop>
+#include <QTimer>
+#include <limits>
+#include <qftp.h>
+
+FtpRemoteFile::FtpRemoteFile(QObject *parent)
+    : QIODevice(parent)
+{
+    _blocks.setMaxCost(16 * 1024 * 1024);
+}
+
+FtpRemoteFile::FtpRemoteFile(const QString &fileName, QObject *parent)
+    : FtpRemoteFile(parent)
+{
+    _fileName = fileName;
+}
+
+FtpRemoteFile::~FtpRemoteFile()
+{
+    close();
+}
+
+void FtpRemoteFile::setSession(const QString &host, quint16 port, const QString &user, const QString &password)
+{
+    _host = host;
+    _port = port;
+    _user = user;
+    _password = password;
+}
+
+QString FtpRemoteFile::fileName() const
+{
+    return _fileName;
+}
+
+void FtpRemoteFile::setFileName(const QString &fileName)
+{
+    close();
+    _fileName = fileName;
+    _size = -1;
+}
+
+void FtpRemoteFile::setSize(qint64 size)
+{
+    if (!isOpen()) {
+        _size = size;
+    }
+}
+
+int FtpRemoteFile::blockSize() const
+{
+    return _blockSize;
+}
+
+void FtpRemoteFile::setBlockSize(int bytes)
+{
+    if (!isOpen()) {
+        _blockSize = qBound(512, bytes, std::numeric_limits<int>::max() / 2);
+        _blocks.clear();
+        // Блок дороже всего кэша QCache не примет, и чтение ждало бы вечно.
+        if (_blocks.maxCost() < 2 * _blockSize) {
+            _blocks.setMaxCost(2 * _blockSize);
+        }
+    }
+}
+
+qint64 FtpRemoteFile::cacheSize() const
+{
+    return _blocks.maxCost();
+}
+
+void FtpRemoteFile::setCacheSize(qint64 bytes)
+{
+    _blocks.setMaxCost(int(qBound<qint64>(2 * qint64(_blockSize), bytes, std::numeric_limits<int>::max())));
+}
+
+qint64 FtpRemoteFile::maxReadAhead() const
+{
+    return _maxReadAhead;
+}
+
+void FtpRemoteFile::setMaxReadAhead(qint64 bytes)
+{
+    _maxReadAhead = qMax<qint64>(_blockSize, bytes);
+}
+
+int FtpRemoteFile::concurrency() const
+{
+    return _concurrency;
+}
+
+void FtpRemoteFile::setConcurrency(int sessions)
+{
+    _concurrency = qMax(1, sessions);
+    schedule();
+}
+
+bool FtpRemoteFile::open(OpenMode mode)
+{
+    if (isOpen()) {
+        return false;
+    }
+    if (mode & (WriteOnly | Append | Truncate)) {
+        setErrorString(tr("The file can only be read"));
+        return false;
+    }
+    if (_fileName.isEmpty()) {
+        setErrorString(tr("No file name specified"));
+        return false;
+    }
+    // Буфер QIODevice не нужен: блоки и так в кэше.
+    if (!QIODevice::open(mode | Unbuffered)) {
+        return false;
+    }
+    _failed = false;
+    _failedSessions = 0;
+    _lastReadEnd = -1;
+    _readAhead = _blockSize;
+    schedule();
+    return true;
+}
+
+void FtpRemoteFile::close()
+{
+    if (!isOpen()) {
+        return;
+    }
+    QIODevice::close();
+    _queue.clear();
+    for (int s = _sessions.size() - 1; s >= 0; --s) {
+        closeSession(s);
+    }
+    _blocks.clear();
+}
+
+bool FtpRemoteFile::isSequential() const
+{
+    return false;
+}
+
+qint64 FtpRemoteFile::size() const
+{
+    return qMax<qint64>(0, _size);
+}
+
+bool FtpRemoteFile::atEnd() const
+{
+    return !isOpen() || (_size >= 0 && pos() >= _size);
+}
+
+qint64 FtpRemoteFile::bytesAvailable() const
+{
+    return isOpen() ? cachedFrom(pos()) : 0;
+}
+
+bool FtpRemoteFile::waitForReadyRead(int msecs)
+{
+    return wait(msecs, true);
+}
+
+bool FtpRemoteFile::waitForOpened(int msecs)
+{
+    return wait(msecs, false);
+}
+
+void FtpRemoteFile::prefetch(qint64 offset, qint64 length)
+{
+    request(offset, length, false);
+}
+
+qint64 FtpRemoteFile::readData(char *data, qint64 maxSize)
+{
+    if (_failed) {
+        return -1;
+    }
+    const qint64 start = pos();
+    qint64 done = 0;
+    while (done < maxSize && _size >= 0 && start + done < _size) {
+        const qint64 offset = start + done;
+        const QByteArray *block = _blocks.object(offset / _blockSize);
+        if (!block) {
+            break;
+        }
+        const qint64 n = qMin(maxSize - done, block->size() - offset % _blockSize);
+        if (n <= 0) {
+            break;
+        }
+        memcpy(data + done, block->constData() + offset % _blockSize, size_t(n));
+        done += n;
+    }
+
+    // Переход в другое место - упреждение в один блок. Чтение подряд
+    // удваивает его на каждом новом блоке и продлевает идущий RETR.
+    const qint64 end = start + done;
+    const bool nextBlock = end / _blockSize != start / _blockSize;
+    if (start != _lastReadEnd) {
+        _readAhead = _blockSize;
+    } else if (nextBlock) {
+        _readAhead = qMax<qint64>(_blockSize, qMin(_readAhead * 2, _maxReadAhead));
+    }
+    if (start != _lastReadEnd || nextBlock || done == 0) {
+        request(end, _readAhead, true);
+    }
+    _lastReadEnd = end;
+    return done;
+}
+
+qint64 FtpRemoteFile::writeData(const char *, qint64)
+{
+    return -1;
+}
+
+bool FtpRemoteFile::isCached(qint64 offset) const
+{
+    return _blocks.contains(offset / _blockSize);
+}
+
+qint64 FtpRemoteFile::cachedFrom(qint64 offset) const
+{
+    qint64 at = offset;
+    while (_size >= 0 && at < _size) {
+        const QByteArray *block = _blocks.object(at / _blockSize);
+        const qint64 n = block ? block->size() - at % _blockSize : 0;
+        if (n <= 0) {
+            break;
+        }
+        at += n;
+    }
+    return at - offset;
+}
+
+void FtpRemoteFile::request(qint64 offset, qint64 length, bool urgent)
+{
+    if (!isOpen() || _failed || offset < 0 || length <= 0 || (_size >= 0 && offset >= _size)) {
+        return;
+    }
+    // Больше, чем влезает в кэш рядом с блоком под pos(), не заказываем:
+    // начало участка вытеснялось бы его же концом.
+    length = qMin(length, qMax<qint64>(_blockSize, cacheSize() - _blockSize));
+    Range range;
+    range.start = offset - offset % _blockSize;
+    range.end = (offset + length + _blockSize - 1) / _blockSize * _blockSize;
+    range.urgent = urgent;
+    if (urgent) {
+        // Читатель ушёл отсюда: прежние срочные заказы устарели.
+        for (int i = _queue.size() - 1; i >= 0; --i) {
+            if (_queue.at(i).urgent) {
+                _queue.removeAt(i);
+            }
+        }
+        _queue.prepend(range);
+    } else {
+        _queue.enqueue(range);
+    }
+    schedule();
+}
+
+void FtpRemoteFile::schedule()
+{
+    if (!isOpen() || _failed) {
+        return;
+    }
+    if (_size < 0) {
+        // Сначала размер: без него неизвестна длина последнего блока.
+        int free = -1;
+        for (int s = 0; s < _sessions.size(); ++s) {
+            if (_sessions.at(s).sizeId != 0) {
+                return;
+            }
+            if (free < 0 && _sessions.at(s).getId == 0) {
+                free = s;
+            }
+        }
+        if (free < 0) {
+            free = openSession();
+        }
+        if (free >= 0) {
+            QFtp *ftp = _sessions.at(free).ftp;
+            ftp->rawCommand(QStringLiteral("TYPE I"));
+            _sessions[free].sizeId = ftp->rawCommand(QLatin1String("SIZE ") + _fileName);
+        }
+        return;
+    }
+
+    while (!_queue.isEmpty()) {
+        Range &range = _queue.head();
+        // Блоки, которые уже в кэше, с начала участка не качаем.
+        range.end = qMin(range.end, _size);
+        while (range.start < range.end && isCached(range.start)) {
+            range.start += _blockSize;
+        }
+        if (range.start >= range.end) {
+            _queue.dequeue();
+            continue;
+        }
+        // Участок продолжает идущий RETR - он просто читает дальше.
+        bool joined = false;
+        for (auto &s : _sessions) {
+            if (s.getId != 0 && !s.aborting && range.start >= s.next && range.start <= s.end) {
+                s.end = qMax(s.end, range.end);
+                s.urgent = s.urgent || range.urgent;
+                joined = true;
+                break;
+            }
+        }
+        if (joined) {
+            _queue.dequeue();
+            continue;
+        }
+        int free = -1;
+        for (int s = 0; s < _sessions.size() && free < 0; ++s) {
+            if (_sessions.at(s).getId == 0 && _sessions.at(s).sizeId == 0) {
+                free = s;
+            }
+        }
+        if (free < 0) {
+            free = openSession();
+        }
+        if (free >= 0) {
+            startFetch(free, _queue.dequeue());
+            continue;
+        }
+        // Свободных соединений нет. Срочному участку уступает RETR про
+        // запас, а если таких нет - любой. Одного прерывания за раз хватит.
+        if (range.urgent) {
+            int victim = -1;
+            for (int s = 0; s < _sessions.size(); ++s) {
+                const Session &session = _sessions.at(s);
+                if (session.aborting) {
+                    victim = -1;
+                    break;
+                }
+                if (session.getId != 0 && (victim < 0 || (!session.urgent && _sessions.at(victim).urgent))) {
+                    victim = s;
+                }
+            }
+            if (victim >= 0) {
+                _sessions[victim].aborting = true;
+                _sessions.at(victim).ftp->abort();
+            }
+        }
+        break;
+    }
+}
+
+int FtpRemoteFile::openSession()
+{
+    if (_sessions.size() >= _concurrency || _failedSessions >= _concurrency) {
+        return -1;
+    }
+    Session session;
+    QFtp *ftp = new QFtp(this);
+    session.ftp = ftp;
+    ftp->setFastAbort(true);
+    connect(ftp, &QFtp::readyRead, this, [this, ftp]() {
+        dataReceived(sessionOf(ftp));
+    });
+    connect(ftp, &QFtp::rawCommandReply, this, [this, ftp](int code, const QString &text) {
+        rawCommandReply(sessionOf(ftp), code, text);
+    });
+    connect(ftp, &QFtp::commandFinished, this, [this, ftp](int id, bool error) {
+        commandFinished(sessionOf(ftp), id, error);
+    });
+    ftp->connectToHost(_host, _port);
+    ftp->login(_user, _password);
+    _sessions.append(session);
+    return _sessions.size() - 1;
+}
+
+void FtpRemoteFile::closeSession(int s)
+{
+    QFtp *ftp = _sessions.at(s).ftp;
+    ftp->disconnect(this);
+    ftp->abort();
+    ftp->deleteLater();
+    _sessions.remove(s);
+}
+
+int FtpRemoteFile::sessionOf(QFtp *ftp) const
+{
+    for (int s = 0; s < _sessions.size(); ++s) {
+        if (_sessions.at(s).ftp == ftp) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+void FtpRemoteFile::startFetch(int s, const Range &range)
+{
+    Session &session = _sessions[s];
+    session.next = range.start;
+    session.end = range.end;
+    session.urgent = range.urgent;
+    session.aborting = false;
+    session.block.clear();
+    session.getId = session.ftp->get(_fileName, nullptr, QFtp::Binary, range.start);
+}
+
+bool FtpRemoteFile::storeBlocks(Session &session, const QByteArray &data)
+{
+    if (session.getId == 0 || session.aborting) {
+        return false;
+    }
+    session.block += data;
+    const qint64 current = pos() / _blockSize;
+    bool wake = false;
+    for (;;) {
+        const qint64 length = qMin<qint64>(_blockSize, _size - session.next);
+        if (length <= 0 || session.block.size() < length) {
+            break;
+        }
+        const qint64 index = session.next / _blockSize;
+        _blocks.insert(index, new QByteArray(session.block.left(int(length))), int(length));
+        session.block.remove(0, int(length));
+        session.next += length;
+        wake = wake || index == current;
+    }
+    return wake;
+}
+
+void FtpRemoteFile::dataReceived(int s)
+{
+    if (s < 0) {
+        return;
+    }
+    Session &session = _sessions[s];
+    const bool wake = storeBlocks(session, session.ftp->readAll());
+    // Сколько заказано, прочитано - остальное не качаем.
+    if (session.getId != 0 && !session.aborting && session.next >= session.end && session.next < _size) {
+        session.aborting = true;
+        session.ftp->abort();
+    }
+    if (wake) {
+        emit readyRead();
+    }
+}
+
+void FtpRemoteFile::rawCommandReply(int s, int code, const QString &text)
+{
+    if (s < 0 || _sessions.at(s).sizeId == 0 || code != 213) {
+        return;
+    }
+    bool ok = false;
+    const qint64 size = text.trimmed().toLongLong(&ok);
+    if (ok && size >= 0) {
+        _size = size;
+    }
+}
+
+void FtpRemoteFile::commandFinished(int s, int id, bool error)
+{
+    if (s < 0) {
+        return;
+    }
+    Session &session = _sessions[s];
+    if (id == session.sizeId) {
+        session.sizeId = 0;
+        if (_size < 0) {
+            fail(error ? session.ftp->errorString() : tr("Cannot get the size of %1").arg(_fileName));
+            return;
+        }
+        emit opened();
+        schedule();
+        return;
+    }
+
+    if (id == session.getId) {
+        const bool aborted = session.aborting;
+        // Остаток данных, в том числе короткий последний блок файла.
+        const bool wake = !error && storeBlocks(session, session.ftp->readAll());
+        Range rest;
+        rest.start = session.next;
+        rest.end = session.end;
+        rest.urgent = session.urgent;
+        session.getId = 0;
+        session.aborting = false;
+        session.block.clear();
+        if (error && !aborted) {
+            // Обрыв или сервер не умеет REST: участок - другому
+            // соединению, пока их не кончится concurrency().
+            const QString message = session.ftp->errorString();
+            ++_failedSessions;
+            closeSession(s);
+            if (_failedSessions >= _concurrency && _sessions.isEmpty()) {
+                fail(message);
+                return;
+            }
+            _queue.prepend(rest);
+        }
+        schedule();
+        if (wake) {
+            emit readyRead();
+        }
+        return;
+    }
+
+    if (error) {
+        // Не удалось подключиться или войти; заказанное отдаём другим.
+        const QString message = session.ftp->errorString();
+        if (session.getId != 0 && !session.aborting) {
+            Range rest;
+            rest.start = session.next;
+            rest.end = session.end;
+            rest.urgent = session.urgent;
+            _queue.prepend(rest);
+        }
+        ++_failedSessions;
+        closeSession(s);
+        if (_failedSessions >= _concurrency && _sessions.isEmpty()) {
+            fail(message);
+        } else {
+            schedule();
+        }
+    }
+}
+
+void FtpRemoteFile::fail(const QString &message)
+{
+    _failed = true;
+    _queue.clear();
+    for (int s = _sessions.size() - 1; s >= 0; --s) {
+        closeSession(s);
+    }
+    setErrorString(message);
+    emit error(message);
+}
+
+bool FtpRemoteFile::wait(int msecs, bool forData)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    const auto done = [this, forData]() {
+        return _failed || !isOpen() || (forData ? cachedFrom(pos()) > 0 || atEnd() : _size >= 0);
+    };
+    if (forData) {
+        request(pos(), _readAhead, true);
+    }
+    if (!done()) {
+        QEventLoop loop;
+        QTimer timer;
+        timer.setSingleShot(true);
+        connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+        connect(this, &FtpRemoteFile::error, &loop, &QEventLoop::quit);
+        connect(this, &QIODevice::aboutToClose, &loop, &QEventLoop::quit);
+        connect(this, &QIODevice::readyRead, &loop, [&]() {
+            if (done()) {
+                loop.quit();
+            }
+        });
+        // Размер узнан: теперь можно заказать и данные.
+        connect(this, &FtpRemoteFile::opened, &loop, [&]() {
+            if (forData) {
+                request(pos(), _readAhead, true);
+            }
+            if (done()) {
+                loop.quit();
+            }
+        });
+        if (msecs >= 0) {
+            timer.start(msecs);
+        }
+        loop.exec(QEventLoop::ExcludeUserInputEvents);
+    }
+    return isOpen() && !_failed && (forData ? cachedFrom(pos()) > 0 : _size >= 0);
+}
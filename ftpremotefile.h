@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCache>
+#include <QIODevice>
+#include <QQueue>
+#include <QVector>
+
+class QFtp;
+
+// Файл сервера как устройство с произвольным доступом, только чтение.
+// Файл читается блоками blockSize() байт, выровненными по границе
+// блока: RETR с нужного места (REST) и ABOR, как только прочитано
+// сколько нужно. Прочитанные блоки лежат в LRU-кэше на cacheSize() байт.
+//
+// Последовательное чтение растит упреждение вдвое до maxReadAhead(), и
+// уже идущий RETR просто продлевается - файл течёт одним потоком.
+// Переход в другое место сбрасывает упреждение до одного блока: для
+// случайного доступа качаются только нужные блоки.
+//
+// Устройство, как и сокет, не блокирует: read() отдаёт то, что уже в
+// кэше, и заказывает остальное; readyRead() - пришёл блок под pos().
+// Для блокирующего чтения - waitForReadyRead(), крутящая локальный цикл
+// событий. Размер файла узнаётся командой SIZE после open() (сигнал
+// opened()) или задаётся заранее setSize(), например из листинга.
+// Соединений - до concurrency(): prefetch() позволяет заранее заказать
+// участки, которые понадобятся (скажем, хвост архива).
+class FtpRemoteFile : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit FtpRemoteFile(QObject *parent = nullptr);
+    FtpRemoteFile(const QString &fileName, QObject *parent = nullptr);
+    ~FtpRemoteFile() override;
+
+    void setSession(const QString &host, quint16 port, const QString &user, const QString &password);
+    QString fileName() const;
+    void setFileName(const QString &fileName);
+    // Известный размер файла: open() тогда не спрашивает SIZE.
+    void setSize(qint64 size);
+
+    // Размер блока меняется только у закрытого файла. Кэш не меньше двух
+    // блоков; заказ за раз не больше кэша без одного блока.
+    int blockSize() const;
+    void setBlockSize(int bytes);
+    qint64 cacheSize() const;
+    void setCacheSize(qint64 bytes);
+    qint64 maxReadAhead() const;
+    void setMaxReadAhead(qint64 bytes);
+    int concurrency() const;
+    void setConcurrency(int sessions);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override;
+    qint64 size() const override;
+    bool atEnd() const override;
+    // Сколько байт от pos() можно прочитать без ожидания.
+    qint64 bytesAvailable() const override;
+    bool waitForReadyRead(int msecs) override;
+    // Ждать, пока станет известен размер файла.
+    bool waitForOpened(int msecs = 30000);
+
+    // Заказать участок заранее; не мешает чтению с pos().
+    void prefetch(qint64 offset, qint64 length);
+
+signals:
+    void opened();
+    void error(const QString &message);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    struct Range {
+        qint64 start = 0;
+        qint64 end = 0;
+        // Нужен читателю сейчас, а не про запас.
+        bool urgent = false;
+    };
+
+    struct Session {
+        QFtp *ftp = nullptr;
+        int sizeId = 0;
+        // Идущий RETR; 0 - соединение свободно.
+        int getId = 0;
+        // Начало блока, который сейчас принимается, и докуда читать.
+        qint64 next = 0;
+        qint64 end = 0;
+        QByteArray block;
+        bool urgent = false;
+        // RETR прерывается: данные уже не нужны.
+        bool aborting = false;
+    };
+
+    void request(qint64 offset, qint64 length, bool urgent);
+    void schedule();
+    int openSession();
+    void closeSession(int s);
+    int sessionOf(QFtp *ftp) const;
+    void startFetch(int s, const Range &range);
+    // Разложить принятое по блокам; true - пришёл блок под pos().
+    bool storeBlocks(Session &session, const QByteArray &data);
+    void dataReceived(int s);
+    void commandFinished(int s, int id, bool error);
+    void rawCommandReply(int s, int code, const QString &text);
+    void fail(const QString &message);
+    bool isCached(qint64 offset) const;
+    qint64 cachedFrom(qint64 offset) const;
+    bool wait(int msecs, bool forData);
+
+    QString _host;
+    quint16 _port = 21;
+    QString _user;
+    QString _password;
+    QString _fileName;
+
+    qint64 _size = -1;
+    int _blockSize = 64 * 1024;
+    qint64 _maxReadAhead = 2 * 1024 * 1024;
+    int _concurrency = 2;
+    // Ключ - номер блока.
+    QCache<qint64, QByteArray> _blocks;
+
+    QQueue<Range> _queue;
+    QVector<Session> _sessions;
+    int _failedSessions = 0;
+    // Конец прошлого чтения и текущее упреждение.
+    qint64 _lastReadEnd = -1;
+    qint64 _readAhead = 0;
+    bool _failed = false;
+};
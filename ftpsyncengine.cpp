@@ -0,0 +1,989 @@
+#include "ftpsyncengine.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include <qftp.h>
+
+FtpSyncEngine::FtpSyncEngine(QObject *parent)
+    : QObject(parent)
+{
+    connect(&_walker, &FtpTreeWalker::entriesFound, this, &FtpSyncEngine::remoteEntries);
+    connect(&_walker, &FtpTreeWalker::directoryFailed, this, &FtpSyncEngine::remoteDirFailed);
+    connect(&_walker, &FtpTreeWalker::finished, this, [this](bool error) {
+        _walkerDone = true;
+        _walkerFailed = error;
+        if (error) {
+            _error = _walker.errorString();
+        }
+        scanFinished();
+    });
+    connect(&_localScan, &QFutureWatcher<LocalTree>::finished, this, &FtpSyncEngine::scanFinished);
+    connect(&_localHashes, &QFutureWatcher<QHash<QString, QByteArray>>::finished, this, &FtpSyncEngine::verifyFinished);
+}
+
+FtpSyncEngine::~FtpSyncEngine()
+{
+    abort();
+    _localScan.waitForFinished();
+    _localHashes.waitForFinished();
+}
+
+void FtpSyncEngine::setSession(const QString &host, quint16 port, const QString &user, const QString &password)
+{
+    _host = host;
+    _port = port;
+    _user = user;
+    _password = password;
+}
+
+QString FtpSyncEngine::localRoot() const
+{
+    return _localRoot;
+}
+
+void FtpSyncEngine::setLocalRoot(const QString &path)
+{
+    _localRoot = path;
+}
+
+QString FtpSyncEngine::remoteRoot() const
+{
+    return _remoteRoot;
+}
+
+void FtpSyncEngine::setRemoteRoot(const QString &path)
+{
+    _remoteRoot = path;
+}
+
+FtpSyncEngine::Direction FtpSyncEngine::direction() const
+{
+    return _direction;
+}
+
+void FtpSyncEngine::setDirection(Direction direction)
+{
+    _direction = direction;
+}
+
+FtpSyncEngine::Options FtpSyncEngine::options() const
+{
+    return _options;
+}
+
+void FtpSyncEngine::setOptions(Options options)
+{
+    _options = options;
+}
+
+int FtpSyncEngine::concurrency() const
+{
+    return _concurrency;
+}
+
+void FtpSyncEngine::setConcurrency(int sessions)
+{
+    _concurrency = qMax(1, sessions);
+}
+
+QString FtpSyncEngine::hashCommand() const
+{
+    return _hashCommand;
+}
+
+QCryptographicHash::Algorithm FtpSyncEngine::hashAlgorithm() const
+{
+    return _hashAlgorithm;
+}
+
+void FtpSyncEngine::setHashCommand(const QString &command, QCryptographicHash::Algorithm algorithm)
+{
+    _hashCommand = command;
+    _hashAlgorithm = algorithm;
+}
+
+bool FtpSyncEngine::isRunning() const
+{
+    return _stage != Idle;
+}
+
+QVector<FtpSyncEngine::Operation> FtpSyncEngine::plan() const
+{
+    return _plan;
+}
+
+QString FtpSyncEngine::errorString() const
+{
+    return _error;
+}
+
+QString FtpSyncEngine::parentOf(const QString &path)
+{
+    if (path.isEmpty()) {
+        return QString();
+    }
+    const int slash = path.lastIndexOf(QLatin1Char('/'));
+    return slash < 0 ? QString(QLatin1String("")) : path.left(slash);
+}
+
+QString FtpSyncEngine::relativeRemote(const QString &dir) const
+{
+    if (dir == _remoteBase) {
+        return QString(QLatin1String(""));
+    }
+    return dir.mid(_remoteBase.endsWith(QLatin1Char('/')) ? _remoteBase.size() : _remoteBase.size() + 1);
+}
+
+QString FtpSyncEngine::localPath(const QString &path) const
+{
+    return path.isEmpty() ? _localRoot : QDir(_localRoot).filePath(path);
+}
+
+QString FtpSyncEngine::remotePath(const QString &path) const
+{
+    if (path.isEmpty()) {
+        return _remoteBase;
+    }
+    return _remoteBase.endsWith(QLatin1Char('/')) ? _remoteBase + path : _remoteBase + QLatin1Char('/') + path;
+}
+
+bool FtpSyncEngine::isSkipped(const QString &path) const
+{
+    if (_skipped.isEmpty()) {
+        return false;
+    }
+    for (QString p = path; !p.isNull(); p = parentOf(p)) {
+        if (_skipped.contains(p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FtpSyncEngine::start(bool dryRun)
+{
+    abort();
+    _dryRun = dryRun;
+    _failed = false;
+    _error.clear();
+    _tree.clear();
+    _skipped.clear();
+    _remoteRootMissing = false;
+    _probes.clear();
+    _probeQueue.clear();
+    _plan.clear();
+    _failedSessions = 0;
+
+    _stage = Scanning;
+    _remoteBase = QDir::cleanPath(_remoteRoot.isEmpty() ? QStringLiteral("/") : _remoteRoot);
+    _walkerDone = false;
+    _walkerFailed = false;
+    _walker.setSession(_host, _port, _user, _password);
+    _walker.setConcurrency(_concurrency);
+    _walker.setMaxDepth(-1);
+    _walker.setFollowSymLinks(false);
+    _walker.start(_remoteBase);
+    _localScan.setFuture(QtConcurrent::run(&FtpSyncEngine::scanLocal, _localRoot));
+}
+
+void FtpSyncEngine::abort()
+{
+    _walker.abort();
+    for (int s = _sessions.size() - 1; s >= 0; --s) {
+        closeSession(s);
+    }
+    _ready.clear();
+    _stage = Idle;
+}
+
+FtpSyncEngine::LocalTree FtpSyncEngine::scanLocal(const QString &root)
+{
+    LocalTree tree;
+    if (!QFileInfo(root).isDir()) {
+        return tree;
+    }
+    Side rootSide;
+    rootSide.exists = true;
+    rootSide.dir = true;
+    tree.insert(QString(QLatin1String("")), rootSide);
+    const QDir base(root);
+    QDirIterator it(root, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        Side side;
+        side.exists = true;
+        side.link = info.isSymLink();
+        side.dir = info.isDir();
+        side.size = side.dir ? 0 : info.size();
+        side.mtime = info.lastModified().toSecsSinceEpoch();
+        tree.insert(base.relativeFilePath(info.filePath()), side);
+    }
+    return tree;
+}
+
+QHash<QString, QByteArray> FtpSyncEngine::hashLocal(const QString &root, const QStringList &paths,
+                                                    QCryptographicHash::Algorithm algorithm)
+{
+    QHash<QString, QByteArray> result;
+    const QDir base(root);
+    for (const auto &path : paths) {
+        QFile file(base.filePath(path));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        QCryptographicHash hash(algorithm);
+        if (hash.addData(&file)) {
+            result.insert(path, hash.result());
+        }
+    }
+    return result;
+}
+
+void FtpSyncEngine::remoteEntries(const QString &dir, const QVector<FtpDirEntry> &entries)
+{
+    const QString base = relativeRemote(dir);
+    for (const auto &entry : entries) {
+        const QString path = base.isEmpty() ? entry.name() : base + QLatin1Char('/') + entry.name();
+        if (entry.isSymLink()) {
+            // Ссылки на сервере не трогаем.
+            _skipped.insert(path);
+            continue;
+        }
+        Side &side = _tree[path].remote;
+        side.exists = true;
+        side.dir = entry.isDir();
+        side.size = side.dir ? 0 : entry.size();
+        side.mtime = entry.lastModifiedSecs();
+        side.dateOnly = entry.isDateOnly();
+    }
+}
+
+void FtpSyncEngine::remoteDirFailed(const QString &dir, const QString &error)
+{
+    const QString path = relativeRemote(dir);
+    if (path.isEmpty()) {
+        // Корня на сервере нет (или он недоступен).
+        _remoteRootMissing = true;
+        return;
+    }
+    // Содержимое неизвестно: поддерево не синхронизируем.
+    _skipped.insert(path);
+    _failed = true;
+    _error = error;
+}
+
+void FtpSyncEngine::scanFinished()
+{
+    if (_stage != Scanning || !_walkerDone || !_localScan.isFinished()) {
+        return;
+    }
+    const LocalTree local = _localScan.result();
+    for (auto it = local.cbegin(); it != local.cend(); ++it) {
+        if (it.value().link) {
+            // Ссылки локально тоже не трогаем.
+            _skipped.insert(it.key());
+        } else {
+            _tree[it.key()].local = it.value();
+        }
+    }
+    if (!_remoteRootMissing) {
+        Side &root = _tree[QString(QLatin1String(""))].remote;
+        root.exists = true;
+        root.dir = true;
+    }
+    if (_walkerFailed) {
+        // Не удалось войти на сервер.
+        finish(true);
+        return;
+    }
+    // Без источника синхронизация в одну сторону удалила бы всё в приёмнике.
+    const Pair &root = _tree.value(QString(QLatin1String("")));
+    if ((_direction == LocalToRemote && !root.local.exists)
+            || (_direction == RemoteToLocal && !root.remote.exists)) {
+        _error = tr("Source directory does not exist");
+        finish(true);
+        return;
+    }
+    verify();
+}
+
+void FtpSyncEngine::verify()
+{
+    _stage = Verifying;
+    // В обе стороны время выбирает направление и для файлов разного размера.
+    const bool mdtmAll = (_options & CompareMdtm) && _direction == Bidirectional;
+    QStringList hashed;
+    if (_options & (CompareMdtm | CompareHash)) {
+        for (auto it = _tree.cbegin(); it != _tree.cend(); ++it) {
+            const Pair &p = it.value();
+            if (!p.local.exists || !p.remote.exists || p.local.dir || p.remote.dir || isSkipped(it.key())) {
+                continue;
+            }
+            const bool sameSize = p.local.size == p.remote.size;
+            if (sameSize || mdtmAll) {
+                _probeQueue.append(_probes.size());
+                _probes.append(it.key());
+            }
+            if (sameSize && (_options & CompareHash)) {
+                hashed.append(it.key());
+            }
+        }
+    }
+    _hashesDone = hashed.isEmpty();
+    if (!_hashesDone) {
+        _localHashes.setFuture(QtConcurrent::run(&FtpSyncEngine::hashLocal, _localRoot, hashed, _hashAlgorithm));
+    }
+    schedule();
+    verifyFinished();
+}
+
+void FtpSyncEngine::verifyFinished()
+{
+    if (_stage != Verifying) {
+        return;
+    }
+    if (!_hashesDone && _localHashes.isFinished()) {
+        _hashesDone = true;
+        const QHash<QString, QByteArray> hashes = _localHashes.result();
+        for (auto it = hashes.cbegin(); it != hashes.cend(); ++it) {
+            _tree[it.key()].localHash = it.value();
+        }
+    }
+    if (!_hashesDone || !_probeQueue.isEmpty()) {
+        return;
+    }
+    for (const auto &s : qAsConst(_sessions)) {
+        if (s.task >= 0) {
+            return;
+        }
+    }
+    makePlan();
+}
+
+FtpSyncEngine::Comparison FtpSyncEngine::compare(const Pair &p) const
+{
+    Comparison c;
+    c.precise = p.remoteMdtm != FtpDirEntry::NoTime;
+    const qint64 remoteTime = c.precise ? p.remoteMdtm : p.remote.mtime;
+    // MDTM даёт время с точностью до секунды, LIST - до минуты, а для
+    // старых файлов только дату.
+    const qint64 tolerance = c.precise ? 2 : p.remote.dateOnly ? 24 * 60 * 60 : 60;
+    if (p.local.mtime != FtpDirEntry::NoTime && remoteTime != FtpDirEntry::NoTime) {
+        const qint64 diff = p.local.mtime - remoteTime;
+        c.newer = diff > tolerance ? 1 : diff < -tolerance ? -1 : 0;
+    }
+    if (p.local.size != p.remote.size) {
+        c.differs = true;
+        c.reason = Operation::SizeDiffers;
+    } else if ((_options & CompareHash) && !p.localHash.isEmpty() && !p.remoteHash.isEmpty()) {
+        c.differs = p.localHash != p.remoteHash;
+        c.reason = Operation::ContentDiffers;
+    } else {
+        c.differs = c.newer != 0;
+        c.reason = Operation::Newer;
+    }
+    return c;
+}
+
+int FtpSyncEngine::addOperation(Operation::Type type, Operation::Reason reason, const QString &path, qint64 size)
+{
+    Operation op;
+    op.type = type;
+    op.reason = reason;
+    op.path = path;
+    op.size = size;
+    _plan.append(op);
+    return _plan.size() - 1;
+}
+
+void FtpSyncEngine::makePlan()
+{
+    const bool deleting = (_options & DeleteExtraneous) && _direction != Bidirectional;
+    for (auto it = _tree.cbegin(); it != _tree.cend(); ++it) {
+        const QString &path = it.key();
+        const Pair &p = it.value();
+        if (isSkipped(path)) {
+            continue;
+        }
+        const Side &l = p.local;
+        const Side &r = p.remote;
+        if (l.exists && r.exists) {
+            if (l.dir != r.dir) {
+                addOperation(Operation::Conflict, Operation::TypeMismatch, path, 0);
+                continue;
+            }
+            if (l.dir) {
+                continue;
+            }
+            const Comparison c = compare(p);
+            if (!c.differs) {
+                continue;
+            }
+            // В одну сторону разница только во времени переносится, лишь
+            // когда источник новее: если сервер не знает ни MFMT, ни MDTM,
+            // время на сервере - время выгрузки, и файл иначе выгружался
+            // бы каждый раз.
+            switch (_direction) {
+            case LocalToRemote:
+                if (c.reason != Operation::Newer || c.newer > 0) {
+                    addOperation(Operation::Upload, c.reason, path, l.size);
+                }
+                break;
+            case RemoteToLocal:
+                if (c.reason != Operation::Newer || c.newer < 0) {
+                    addOperation(Operation::Download, c.reason, path, r.size);
+                }
+                break;
+            case Bidirectional:
+                if (!c.precise) {
+                    addOperation(Operation::Conflict, c.reason, path, 0);
+                } else if (c.newer > 0) {
+                    addOperation(Operation::Upload, c.reason, path, l.size);
+                } else if (c.newer < 0) {
+                    addOperation(Operation::Download, c.reason, path, r.size);
+                } else {
+                    addOperation(Operation::Conflict, c.reason, path, 0);
+                }
+                break;
+            }
+        } else if (l.exists) {
+            if (_direction != RemoteToLocal) {
+                addOperation(l.dir ? Operation::MakeRemoteDir : Operation::Upload, Operation::Missing, path, l.size);
+            } else if (deleting && !path.isEmpty()) {
+                addOperation(l.dir ? Operation::RemoveLocalDir : Operation::RemoveLocal, Operation::Extraneous, path, 0);
+            }
+        } else if (r.exists) {
+            if (_direction != LocalToRemote) {
+                addOperation(r.dir ? Operation::MakeLocalDir : Operation::Download, Operation::Missing, path, r.size);
+            } else if (deleting && !path.isEmpty()) {
+                addOperation(r.dir ? Operation::RemoveRemoteDir : Operation::RemoveRemote, Operation::Extraneous, path, 0);
+            }
+        }
+    }
+
+    // Создаваемое ждёт создания родителя (или падает вместе с конфликтом
+    // на его месте), удаляемый каталог ждёт удаления содержимого.
+    QHash<QString, int> creators;
+    QHash<QString, int> removers;
+    for (int i = 0; i < _plan.size(); ++i) {
+        switch (_plan.at(i).type) {
+        case Operation::MakeLocalDir:
+        case Operation::MakeRemoteDir:
+        case Operation::Conflict:
+            creators.insert(_plan.at(i).path, i);
+            break;
+        case Operation::RemoveLocalDir:
+        case Operation::RemoveRemoteDir:
+            removers.insert(_plan.at(i).path, i);
+            break;
+        case Operation::Upload:
+        case Operation::Download:
+        case Operation::RemoveLocal:
+        case Operation::RemoveRemote:
+            break;
+        }
+    }
+    _blockers.fill(0, _plan.size());
+    _dependents = QVector<QVector<int>>(_plan.size());
+    for (int i = 0; i < _plan.size(); ++i) {
+        const Operation &op = _plan.at(i);
+        const QString parent = parentOf(op.path);
+        if (parent.isNull()) {
+            continue;
+        }
+        const bool removal = op.type == Operation::RemoveLocal || op.type == Operation::RemoveRemote
+                || op.type == Operation::RemoveLocalDir || op.type == Operation::RemoveRemoteDir;
+        if (removal) {
+            const int dir = removers.value(parent, -1);
+            if (dir >= 0) {
+                _dependents[i].append(dir);
+                ++_blockers[dir];
+            }
+        } else {
+            const int dir = creators.value(parent, -1);
+            if (dir >= 0) {
+                _dependents[dir].append(i);
+                ++_blockers[i];
+            }
+        }
+    }
+
+    for (const auto &op : qAsConst(_plan)) {
+        emit planned(op);
+    }
+    if (_dryRun) {
+        finish(_failed);
+        return;
+    }
+    execute();
+}
+
+void FtpSyncEngine::execute()
+{
+    _stage = Executing;
+    _pending = _plan.size();
+    for (int i = 0; i < _plan.size(); ++i) {
+        if (_blockers.at(i) == 0) {
+            _ready.append(i);
+        }
+    }
+    schedule();
+}
+
+bool FtpSyncEngine::isLocal(int op) const
+{
+    switch (_plan.at(op).type) {
+    case Operation::MakeLocalDir:
+    case Operation::RemoveLocal:
+    case Operation::RemoveLocalDir:
+    case Operation::Conflict:
+        return true;
+    case Operation::MakeRemoteDir:
+    case Operation::Upload:
+    case Operation::Download:
+    case Operation::RemoveRemote:
+    case Operation::RemoveRemoteDir:
+        break;
+    }
+    return false;
+}
+
+bool FtpSyncEngine::runLocal(int op, QString *error)
+{
+    const Operation &o = _plan.at(op);
+    const QString path = localPath(o.path);
+    switch (o.type) {
+    case Operation::MakeLocalDir:
+        if (QDir().mkpath(path)) {
+            return true;
+        }
+        *error = tr("Cannot create directory %1").arg(path);
+        return false;
+    case Operation::RemoveLocal: {
+        QFile file(path);
+        if (file.remove()) {
+            return true;
+        }
+        *error = file.errorString();
+        return false;
+    }
+    case Operation::RemoveLocalDir:
+        if (QDir().rmdir(path)) {
+            return true;
+        }
+        *error = tr("Cannot remove directory %1").arg(path);
+        return false;
+    case Operation::Conflict:
+        *error = tr("Conflicting changes, not synchronized");
+        return false;
+    case Operation::MakeRemoteDir:
+    case Operation::Upload:
+    case Operation::Download:
+    case Operation::RemoveRemote:
+    case Operation::RemoveRemoteDir:
+        break;
+    }
+    return false;
+}
+
+bool FtpSyncEngine::startRemote(int s, int op)
+{
+    Session &session = _sessions[s];
+    QFtp *ftp = session.ftp;
+    const Operation &o = _plan.at(op);
+    const QString remote = remotePath(o.path);
+    switch (o.type) {
+    case Operation::MakeRemoteDir:
+        session.lastId = ftp->mkdir(remote);
+        break;
+    case Operation::RemoveRemote:
+        session.lastId = ftp->remove(remote);
+        break;
+    case Operation::RemoveRemoteDir:
+        session.lastId = ftp->rmdir(remote);
+        break;
+    case Operation::Upload: {
+        // Устройство - дочерний объект QFtp: при abort() уходит вместе с ним.
+        auto *file = new QFile(localPath(o.path), ftp);
+        if (!file->open(QIODevice::ReadOnly)) {
+            const QString error = file->errorString();
+            delete file;
+            operationDone(op, true, error);
+            return false;
+        }
+        session.device = file;
+        session.lastId = ftp->put(file, remote);
+        break;
+    }
+    case Operation::Download: {
+        auto *file = new QSaveFile(localPath(o.path), ftp);
+        if (!file->open(QIODevice::WriteOnly)) {
+            const QString error = file->errorString();
+            delete file;
+            operationDone(op, true, error);
+            return false;
+        }
+        session.device = file;
+        session.lastId = ftp->get(remote, file);
+        break;
+    }
+    case Operation::MakeLocalDir:
+    case Operation::RemoveLocal:
+    case Operation::RemoveLocalDir:
+    case Operation::Conflict:
+        return false;
+    }
+    session.task = op;
+    return true;
+}
+
+void FtpSyncEngine::startProbe(int s, int probe)
+{
+    Session &session = _sessions[s];
+    const QString remote = remotePath(_probes.at(probe));
+    session.task = probe;
+    session.mdtmId = 0;
+    session.hashId = 0;
+    if (_options & CompareMdtm) {
+        session.mdtmId = session.ftp->rawCommand(QLatin1String("MDTM ") + remote);
+    }
+    const Pair &pair = _tree.value(_probes.at(probe));
+    if ((_options & CompareHash) && pair.local.size == pair.remote.size) {
+        session.hashId = session.ftp->rawCommand(_hashCommand + QLatin1Char(' ') + remote);
+    }
+    session.lastId = session.hashId ? session.hashId : session.mdtmId;
+}
+
+bool FtpSyncEngine::startTimeSync(int s, int op)
+{
+    const Pair &pair = _tree.value(_plan.at(op).path);
+    if (pair.local.mtime == FtpDirEntry::NoTime) {
+        return false;
+    }
+    // Без этого на сервере осталось бы время выгрузки, и в обе стороны
+    // следующий проход счёл бы файл там новее и скачал обратно.
+    Session &session = _sessions[s];
+    const QString time = QDateTime::fromSecsSinceEpoch(pair.local.mtime, Qt::UTC)
+            .toString(QStringLiteral("yyyyMMddHHmmss"));
+    session.task = op;
+    session.timeFromServer = false;
+    session.timeId = session.ftp->rawCommand(QLatin1String("MFMT ") + time + QLatin1Char(' ')
+                                             + remotePath(_plan.at(op).path));
+    session.lastId = session.timeId;
+    return true;
+}
+
+void FtpSyncEngine::setLocalTime(const QString &path, qint64 mtime)
+{
+    QFile file(localPath(path));
+    if (mtime != FtpDirEntry::NoTime && file.open(QIODevice::Append)) {
+        file.setFileTime(QDateTime::fromSecsSinceEpoch(mtime), QFileDevice::FileModificationTime);
+    }
+}
+
+qint64 FtpSyncEngine::parseMdtm(const QString &text)
+{
+    // 213 YYYYMMDDHHMMSS[.sss], всегда UTC.
+    QDateTime time = QDateTime::fromString(text.trimmed().left(14), QStringLiteral("yyyyMMddHHmmss"));
+    time.setTimeSpec(Qt::UTC);
+    return time.isValid() ? time.toSecsSinceEpoch() : FtpDirEntry::NoTime;
+}
+
+void FtpSyncEngine::schedule()
+{
+    if (_stage == Verifying) {
+        for (int s = 0; s < _sessions.size() && !_probeQueue.isEmpty(); ++s) {
+            if (_sessions.at(s).task < 0) {
+                startProbe(s, _probeQueue.takeFirst());
+            }
+        }
+        while (!_probeQueue.isEmpty() && _sessions.size() < _concurrency && _failedSessions < _concurrency) {
+            openSession();
+            startProbe(_sessions.size() - 1, _probeQueue.takeFirst());
+        }
+        if (!_probeQueue.isEmpty() && !canConnect()) {
+            abandon();
+        }
+        return;
+    }
+    if (_stage != Executing) {
+        return;
+    }
+    // Локальные операции выполняются сразу, сетевые - на свободных
+    // соединениях, остаток ждёт в очереди.
+    QList<int> remote;
+    while (!_ready.isEmpty()) {
+        const int op = _ready.takeFirst();
+        if (isLocal(op)) {
+            QString error;
+            const bool ok = runLocal(op, &error);
+            operationDone(op, !ok, error);
+        } else {
+            remote.append(op);
+        }
+    }
+    for (int s = 0; s < _sessions.size() && !remote.isEmpty(); ++s) {
+        while (_sessions.at(s).task < 0 && !remote.isEmpty()) {
+            startRemote(s, remote.takeFirst());
+        }
+    }
+    while (!remote.isEmpty() && _sessions.size() < _concurrency && _failedSessions < _concurrency) {
+        openSession();
+        const int s = _sessions.size() - 1;
+        while (_sessions.at(s).task < 0 && !remote.isEmpty()) {
+            startRemote(s, remote.takeFirst());
+        }
+    }
+    _ready = remote + _ready;
+    if (!_ready.isEmpty() && !canConnect()) {
+        abandon();
+        return;
+    }
+    if (_pending == 0) {
+        finish(_failed);
+    }
+}
+
+bool FtpSyncEngine::canConnect() const
+{
+    return !_sessions.isEmpty() || _failedSessions < _concurrency;
+}
+
+void FtpSyncEngine::abandon()
+{
+    // Соединений не осталось, а новые уже не открываются: всё
+    // незавершённое заканчивается ошибкой.
+    if (_error.isEmpty()) {
+        _error = tr("Connection to the server lost");
+    }
+    if (_stage == Executing) {
+        for (int op = 0; op < _plan.size(); ++op) {
+            operationDone(op, true, _error);
+        }
+    }
+    _probeQueue.clear();
+    finish(true);
+}
+
+void FtpSyncEngine::operationDone(int op, bool error, const QString &errorString)
+{
+    if (_blockers.at(op) < 0) {
+        return;
+    }
+    _blockers[op] = -1;
+    --_pending;
+    if (error) {
+        _failed = true;
+    }
+    emit operationFinished(_plan.at(op), error, errorString);
+    for (const int dep : _dependents.at(op)) {
+        if (_blockers.at(dep) < 0) {
+            continue;
+        }
+        if (error) {
+            operationDone(dep, true, tr("Depends on a failed operation: %1").arg(_plan.at(op).path));
+        } else if (--_blockers[dep] == 0) {
+            _ready.append(dep);
+        }
+    }
+}
+
+void FtpSyncEngine::finish(bool error)
+{
+    _walker.abort();
+    for (int s = _sessions.size() - 1; s >= 0; --s) {
+        closeSession(s);
+    }
+    _ready.clear();
+    _stage = Idle;
+    emit finished(error);
+}
+
+void FtpSyncEngine::openSession()
+{
+    Session session;
+    QFtp *ftp = new QFtp(this);
+    session.ftp = ftp;
+    ftp->setFastAbort(true);
+    connect(ftp, &QFtp::commandFinished, this, [this, ftp](int id, bool error) {
+        commandFinished(ftp, id, error);
+    });
+    connect(ftp, &QFtp::rawCommandReply, this, [this, ftp](int code, const QString &text) {
+        rawReply(ftp, code, text);
+    });
+    ftp->connectToHost(_host, _port);
+    ftp->login(_user, _password);
+    _sessions.append(session);
+}
+
+void FtpSyncEngine::closeSession(int s)
+{
+    QFtp *ftp = _sessions.at(s).ftp;
+    ftp->disconnect(this);
+    ftp->abort();
+    // Вместе с QFtp удалится и устройство незавершённой передачи.
+    ftp->deleteLater();
+    _sessions.remove(s);
+}
+
+int FtpSyncEngine::sessionOf(QFtp *ftp) const
+{
+    for (int s = 0; s < _sessions.size(); ++s) {
+        if (_sessions.at(s).ftp == ftp) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+void FtpSyncEngine::rawReply(QFtp *ftp, int code, const QString &text)
+{
+    const int s = sessionOf(ftp);
+    if (s < 0 || _sessions.at(s).task < 0) {
+        return;
+    }
+    const Session &session = _sessions.at(s);
+    const int id = ftp->currentId();
+    if (_stage == Executing) {
+        if (id == session.timeId && session.timeFromServer && code == 213) {
+            setLocalTime(_plan.at(session.task).path, parseMdtm(text));
+        }
+        return;
+    }
+    if (_stage != Verifying) {
+        return;
+    }
+    Pair &pair = _tree[_probes.at(session.task)];
+    if (id == session.mdtmId && code == 213) {
+        const qint64 time = parseMdtm(text);
+        if (time != FtpDirEntry::NoTime) {
+            pair.remoteMdtm = time;
+        }
+    } else if (id == session.hashId && code / 100 == 2) {
+        // XMD5 отвечает одним хешем, HASH - ещё и алгоритмом, диапазоном
+        // и именем; берём слово подходящей длины из шестнадцатеричных цифр.
+        const int length = QCryptographicHash::hashLength(_hashAlgorithm) * 2;
+        static const QRegularExpression space(QStringLiteral("\\s+"));
+        static const QRegularExpression hex(QStringLiteral("^[0-9A-Fa-f]+$"));
+        const QStringList words = text.trimmed().split(space);
+        for (const auto &word : words) {
+            if (word.size() == length && hex.match(word).hasMatch()) {
+                pair.remoteHash = QByteArray::fromHex(word.toLatin1());
+                break;
+            }
+        }
+    }
+}
+
+void FtpSyncEngine::commandFinished(QFtp *ftp, int id, bool error)
+{
+    const int s = sessionOf(ftp);
+    if (s < 0) {
+        return;
+    }
+    Session &session = _sessions[s];
+    const bool ours = session.task >= 0 && (id == session.lastId || id == session.mdtmId || id == session.hashId);
+    if (!ours) {
+        if (!error) {
+            return;
+        }
+        // Не удалось подключиться или войти: задачу отдаём другим.
+        _error = ftp->errorString();
+        ++_failedSessions;
+        if (session.task >= 0) {
+            if (_stage == Verifying) {
+                _probeQueue.prepend(session.task);
+            } else {
+                _ready.prepend(session.task);
+            }
+        }
+        closeSession(s);
+        if (!canConnect()) {
+            abandon();
+        } else {
+            schedule();
+            verifyFinished();
+        }
+        return;
+    }
+
+    if (_stage == Verifying) {
+        if (id == session.mdtmId) {
+            session.mdtmId = 0;
+        }
+        if (id == session.hashId) {
+            session.hashId = 0;
+        }
+        if (error) {
+            // Ошибка сбрасывает очередь QFtp: второй команды не будет.
+            // Без уточнения файл сравнится по данным листинга.
+            session.mdtmId = 0;
+            session.hashId = 0;
+        }
+        if (session.mdtmId == 0 && session.hashId == 0) {
+            session.task = -1;
+            if (ftp->state() == QFtp::Unconnected) {
+                closeSession(s);
+            }
+            schedule();
+            verifyFinished();
+        }
+        return;
+    }
+
+    if (session.timeId != 0 && id == session.timeId) {
+        // Сама выгрузка уже удалась: ошибки здесь её не портят.
+        const int op = session.task;
+        session.timeId = 0;
+        if (error && !session.timeFromServer && ftp->state() == QFtp::LoggedIn) {
+            session.timeFromServer = true;
+            session.timeId = ftp->rawCommand(QLatin1String("MDTM ") + remotePath(_plan.at(op).path));
+            session.lastId = session.timeId;
+            return;
+        }
+        session.task = -1;
+        if (ftp->state() == QFtp::Unconnected) {
+            closeSession(s);
+        }
+        operationDone(op, false, QString());
+        schedule();
+        return;
+    }
+
+    const int op = session.task;
+    session.task = -1;
+    bool failed = error;
+    QString errorString = error ? ftp->errorString() : QString();
+    if (QIODevice *device = session.device) {
+        session.device = nullptr;
+        if (auto *file = qobject_cast<QSaveFile *>(device)) {
+            if (!failed && !file->commit()) {
+                failed = true;
+                errorString = file->errorString();
+            } else if (failed) {
+                file->cancelWriting();
+            }
+        }
+        delete device;
+    }
+    if (!failed && _plan.at(op).type == Operation::Download) {
+        // Время как на сервере, чтобы следующая сверка не сочла файл новее.
+        const Pair &pair = _tree.value(_plan.at(op).path);
+        setLocalTime(_plan.at(op).path, pair.remoteMdtm != FtpDirEntry::NoTime ? pair.remoteMdtm : pair.remote.mtime);
+    }
+    if (!failed && _plan.at(op).type == Operation::Upload && ftp->state() == QFtp::LoggedIn
+            && startTimeSync(s, op)) {
+        return;
+    }
+    if (ftp->state() == QFtp::Unconnected) {
+        closeSession(s);
+    }
+    operationDone(op, failed, errorString);
+    schedule();
+}
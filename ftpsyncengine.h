@@ -0,0 +1,276 @@
+#pragma once
+
+#include <QCryptographicHash>
+#include <QFlags>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QVector>
+#include <ftpdirentry.h>
+#include <ftptreewalker.h>
+
+class QFtp;
+class QIODevice;
+
+// Синхронизация локального каталога с деревом на сервере.
+//
+// start() проходит три этапа:
+//   1. Обход: сервер - FtpTreeWalker, локальный каталог - в пуле потоков,
+//      одновременно.
+//   2. Сверка: при CompareMdtm время файла уточняется командой MDTM
+//      (точное время в UTC вместо минут из LIST) - для файлов одинакового
+//      размера, а в обе стороны, где время выбирает направление, - для
+//      всех. При CompareHash файлы одинакового размера сверяются хешем с
+//      сервера (hashCommand(), например XMD5 или XSHA1) и посчитанным
+//      локально.
+//   3. План: операции отдаются сигналом planned() в порядке путей. При
+//      dryRun на этом всё и заканчивается, иначе план выполняется на
+//      concurrency() соединениях. Каталог создаётся раньше всего, что в
+//      нём, удаляется - после всего, что в нём; операция, зависевшая от
+//      неудавшейся, тоже завершается с ошибкой. Результат каждой
+//      операции - сигнал operationFinished().
+//
+// Файл считается изменённым, если отличается размер, хеш (CompareHash)
+// или источник новее приёмника больше чем на погрешность времени (2 с
+// для MDTM, минута для LIST, сутки для LIST без времени суток). В одну
+// сторону источник - соответствующая сторона, удаления лишнего только с
+// DeleteExtraneous. В обе стороны побеждает более новый файл, а
+// недостающее копируется туда, где его нет: без истории прошлых
+// синхронизаций удаление не отличить от создания, поэтому в этом режиме
+// ничего не удаляется. Разный размер при равном времени, изменённый файл,
+// для которого есть только время из LIST (оно в часовом поясе сервера,
+// направление по нему не выбрать), и файл против каталога - конфликты,
+// они попадают в план, но не выполняются.
+//
+// Скачанному файлу ставится время с сервера. Выгруженному на сервере
+// ставится локальное время (MFMT), а если сервер этого не умеет,
+// локальному файлу - время с сервера (MDTM): иначе в обе стороны
+// только что выгруженное на следующем проходе скачалось бы обратно.
+class FtpSyncEngine : public QObject
+{
+    Q_OBJECT
+public:
+    enum Direction {
+        LocalToRemote,
+        RemoteToLocal,
+        Bidirectional
+    };
+    Q_ENUM(Direction)
+
+    enum Option {
+        NoOptions        = 0x0,
+        DeleteExtraneous = 0x1,
+        CompareMdtm      = 0x2,
+        CompareHash      = 0x4
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    struct Operation {
+        enum Type {
+            MakeLocalDir,
+            MakeRemoteDir,
+            Upload,
+            Download,
+            RemoveLocal,
+            RemoveRemote,
+            RemoveLocalDir,
+            RemoveRemoteDir,
+            Conflict
+        };
+        enum Reason {
+            Missing,
+            SizeDiffers,
+            ContentDiffers,
+            Newer,
+            Extraneous,
+            TypeMismatch
+        };
+
+        Type type = Conflict;
+        Reason reason = Missing;
+        // Путь относительно корней, "" - сам корень.
+        QString path;
+        // Для передач - размер файла-источника.
+        qint64 size = 0;
+    };
+
+    explicit FtpSyncEngine(QObject *parent = nullptr);
+    ~FtpSyncEngine() override;
+
+    void setSession(const QString &host, quint16 port, const QString &user, const QString &password);
+
+    QString localRoot() const;
+    void setLocalRoot(const QString &path);
+    QString remoteRoot() const;
+    void setRemoteRoot(const QString &path);
+
+    Direction direction() const;
+    void setDirection(Direction direction);
+    Options options() const;
+    void setOptions(Options options);
+    int concurrency() const;
+    void setConcurrency(int sessions);
+
+    // Команда хеша на сервере и алгоритм, которым считать локально.
+    QString hashCommand() const;
+    QCryptographicHash::Algorithm hashAlgorithm() const;
+    void setHashCommand(const QString &command, QCryptographicHash::Algorithm algorithm);
+
+    bool isRunning() const;
+    QVector<Operation> plan() const;
+    QString errorString() const;
+
+public slots:
+    void start(bool dryRun = false);
+    void abort();
+
+signals:
+    void planned(const FtpSyncEngine::Operation &operation);
+    void operationFinished(const FtpSyncEngine::Operation &operation, bool error, const QString &errorString);
+    void finished(bool error);
+
+private:
+    // Файл или каталог на одной из сторон.
+    struct Side {
+        bool exists = false;
+        bool dir = false;
+        // Символьная ссылка: не синхронизируется.
+        bool link = false;
+        // Время из LIST без времени суток.
+        bool dateOnly = false;
+        qint64 size = 0;
+        qint64 mtime = FtpDirEntry::NoTime;
+    };
+
+    struct Pair {
+        Side local;
+        Side remote;
+        // Уточнения со сверки.
+        qint64 remoteMdtm = FtpDirEntry::NoTime;
+        QByteArray localHash;
+        QByteArray remoteHash;
+    };
+
+    // Итог сравнения файла, который есть с обеих сторон.
+    struct Comparison {
+        bool differs = false;
+        // 1 - локальный новее, -1 - на сервере новее, 0 - в пределах погрешности.
+        int newer = 0;
+        // newer посчитано по MDTM, а не по LIST.
+        bool precise = false;
+        Operation::Reason reason = Operation::Newer;
+    };
+
+    struct Session {
+        QFtp *ftp = nullptr;
+        // Номер проверки (этап сверки) или операции, -1 - свободно.
+        int task = -1;
+        int lastId = 0;
+        int mdtmId = 0;
+        int hashId = 0;
+        QIODevice *device = nullptr;
+        // После выгрузки: MFMT с локальным временем, а если сервер его не
+        // знает - MDTM, под который подгоняется локальный файл.
+        int timeId = 0;
+        bool timeFromServer = false;
+    };
+
+    enum Stage {
+        Idle,
+        Scanning,
+        Verifying,
+        Executing
+    };
+
+    using LocalTree = QMap<QString, Side>;
+    static LocalTree scanLocal(const QString &root);
+    static QHash<QString, QByteArray> hashLocal(const QString &root, const QStringList &paths,
+                                                QCryptographicHash::Algorithm algorithm);
+
+    void remoteEntries(const QString &dir, const QVector<FtpDirEntry> &entries);
+    void remoteDirFailed(const QString &dir, const QString &error);
+    void scanFinished();
+    void verify();
+    void verifyFinished();
+    void makePlan();
+    Comparison compare(const Pair &pair) const;
+    int addOperation(Operation::Type type, Operation::Reason reason, const QString &path, qint64 size);
+    void execute();
+    void schedule();
+    bool isLocal(int op) const;
+    bool runLocal(int op, QString *error);
+    bool startRemote(int s, int op);
+    void startProbe(int s, int probe);
+    bool startTimeSync(int s, int op);
+    void setLocalTime(const QString &path, qint64 mtime);
+    static qint64 parseMdtm(const QString &text);
+    void operationDone(int op, bool error, const QString &errorString);
+    void finish(bool error);
+    bool canConnect() const;
+    void abandon();
+
+    void openSession();
+    void closeSession(int s);
+    int sessionOf(QFtp *ftp) const;
+    void commandFinished(QFtp *ftp, int id, bool error);
+    void rawReply(QFtp *ftp, int code, const QString &text);
+
+    QString relativeRemote(const QString &dir) const;
+    QString localPath(const QString &path) const;
+    QString remotePath(const QString &path) const;
+    bool isSkipped(const QString &path) const;
+    static QString parentOf(const QString &path);
+
+    QString _host;
+    quint16 _port = 21;
+    QString _user;
+    QString _password;
+
+    QString _localRoot;
+    QString _remoteRoot;
+    Direction _direction = LocalToRemote;
+    Options _options = NoOptions;
+    int _concurrency = 4;
+    QString _hashCommand = QStringLiteral("XMD5");
+    QCryptographicHash::Algorithm _hashAlgorithm = QCryptographicHash::Md5;
+
+    Stage _stage = Idle;
+    bool _dryRun = false;
+    bool _failed = false;
+    QString _error;
+
+    // Корень на сервере без завершающего '/', кроме самого "/".
+    QString _remoteBase;
+    FtpTreeWalker _walker;
+    bool _walkerDone = false;
+    bool _walkerFailed = false;
+    QFutureWatcher<LocalTree> _localScan;
+    QFutureWatcher<QHash<QString, QByteArray>> _localHashes;
+    bool _hashesDone = false;
+
+    // Обе стороны по относительному пути; порядок QMap ставит
+    // родителя раньше его содержимого.
+    QMap<QString, Pair> _tree;
+    // Ссылки и непрочитанные каталоги сервера: вместе с поддеревьями
+    // не синхронизируются.
+    QSet<QString> _skipped;
+    bool _remoteRootMissing = false;
+    // Пути, уточняемые на сверке, и очередь их номеров.
+    QStringList _probes;
+    QList<int> _probeQueue;
+
+    QVector<Operation> _plan;
+    // Сколько незавершённых операций держат каждую и кого держит она.
+    QVector<int> _blockers;
+    QVector<QVector<int>> _dependents;
+    QList<int> _ready;
+    int _pending = 0;
+
+    QVector<Session> _sessions;
+    int _failedSessions = 0;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FtpSyncEngine::Options)
+Q_DECLARE_METATYPE(FtpSyncEngine::Operation)
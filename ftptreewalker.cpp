@@ -0,0 +1,494 @@
+#include "ftptreewalker.h"
+
+#include <qftp.h>
+
+FtpTreeWalker::FtpTreeWalker(QObject *parent)
+    : QObject(parent)
+{
+}
+
+FtpTreeWalker::~FtpTreeWalker()
+{
+    abort();
+}
+
+void FtpTreeWalker::setSession(const QString &host, quint16 port, const QString &user, const QString &password)
+{
+    _host = host;
+    _port = port;
+    _user = user;
+    _password = password;
+}
+
+int FtpTreeWalker::concurrency() const
+{
+    return _concurrency;
+}
+
+void FtpTreeWalker::setConcurrency(int sessions)
+{
+    _concurrency = qMax(1, sessions);
+    if (_running) {
+        schedule();
+    }
+}
+
+int FtpTreeWalker::maxDepth() const
+{
+    return _maxDepth;
+}
+
+void FtpTreeWalker::setMaxDepth(int depth)
+{
+    _maxDepth = depth;
+}
+
+QStringList FtpTreeWalker::includePatterns() const
+{
+    return _include;
+}
+
+void FtpTreeWalker::setIncludePatterns(const QStringList &patterns)
+{
+    _include = patterns;
+    _includeRe = compile(patterns);
+}
+
+QStringList FtpTreeWalker::excludePatterns() const
+{
+    return _exclude;
+}
+
+void FtpTreeWalker::setExcludePatterns(const QStringList &patterns)
+{
+    _exclude = patterns;
+    _excludeRe = compile(patterns);
+}
+
+bool FtpTreeWalker::followSymLinks() const
+{
+    return _followSymLinks;
+}
+
+void FtpTreeWalker::setFollowSymLinks(bool follow)
+{
+    _followSymLinks = follow;
+}
+
+bool FtpTreeWalker::recursiveListing() const
+{
+    return _recursiveListing;
+}
+
+void FtpTreeWalker::setRecursiveListing(bool enabled)
+{
+    _recursiveListing = enabled;
+}
+
+bool FtpTreeWalker::isRunning() const
+{
+    return _running;
+}
+
+int FtpTreeWalker::directoriesListed() const
+{
+    return _listed;
+}
+
+int FtpTreeWalker::directoriesPending() const
+{
+    int pending = _queue.size();
+    for (const auto &s : _sessions) {
+        pending += s.listId != 0 ? 1 : 0;
+    }
+    return pending;
+}
+
+QString FtpTreeWalker::errorString() const
+{
+    return _error;
+}
+
+QVector<QRegularExpression> FtpTreeWalker::compile(const QStringList &patterns)
+{
+    QVector<QRegularExpression> result;
+    result.reserve(patterns.size());
+    for (const auto &pattern : patterns) {
+        result.append(QRegularExpression(QRegularExpression::wildcardToRegularExpression(pattern)));
+    }
+    return result;
+}
+
+bool FtpTreeWalker::matches(const QStringList &globs, const QVector<QRegularExpression> &patterns,
+                            const QString &name, const QString &path)
+{
+    for (int i = 0; i < patterns.size(); ++i) {
+        // Смотрим на исходный шаблон: в регулярном выражении '/' есть
+        // всегда, '*' превращается в [^/]*.
+        const bool byPath = globs.at(i).contains(QLatin1Char('/'));
+        if (patterns.at(i).match(byPath ? path : name).hasMatch()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QString FtpTreeWalker::childPath(const QString &dir, const QString &name)
+{
+    return dir.endsWith(QLatin1Char('/')) ? dir + name : dir + QLatin1Char('/') + name;
+}
+
+QVector<FtpDirEntry> FtpTreeWalker::filtered(const QString &dir, const QVector<FtpDirEntry> &entries) const
+{
+    QVector<FtpDirEntry> result;
+    result.reserve(entries.size());
+    for (const auto &entry : entries) {
+        const QString &name = entry.name();
+        if (name == QLatin1String(".") || name == QLatin1String("..")) {
+            continue;
+        }
+        const QString path = childPath(dir, name);
+        if (matches(_exclude, _excludeRe, name, path)) {
+            continue;
+        }
+        if (_includeRe.isEmpty() || matches(_include, _includeRe, name, path)) {
+            result.append(entry);
+        }
+    }
+    return result;
+}
+
+void FtpTreeWalker::start(const QString &root)
+{
+    abort();
+    _error.clear();
+    _listed = 0;
+    _failedSessions = 0;
+    _running = true;
+    Item item;
+    item.path = root.isEmpty() ? QStringLiteral("/") : root;
+    item.tree = _recursiveListing && _maxDepth < 0;
+    _queue.enqueue(item);
+    schedule();
+}
+
+void FtpTreeWalker::abort()
+{
+    _queue.clear();
+    clearTree();
+    for (int s = _sessions.size() - 1; s >= 0; --s) {
+        closeSession(s);
+    }
+    _running = false;
+}
+
+void FtpTreeWalker::schedule()
+{
+    // После abort() из слота сигнала новых листингов не начинаем.
+    if (!_running) {
+        return;
+    }
+    // Свободным соединениям - по каталогу из очереди.
+    for (auto &s : _sessions) {
+        if (_queue.isEmpty()) {
+            break;
+        }
+        if (s.listId == 0) {
+            s.item = _queue.dequeue();
+            s.entries.clear();
+            s.fingerprint = 0;
+            s.listId = s.item.tree ? s.ftp->listRecursive(s.item.path) : s.ftp->list(s.item.path);
+        }
+    }
+    // Остаток очереди - новым соединениям, в пределах concurrency().
+    while (!_queue.isEmpty() && _sessions.size() < _concurrency && _failedSessions < _concurrency) {
+        openSession();
+    }
+    if (!_queue.isEmpty() && _sessions.isEmpty()) {
+        abandon();
+    } else if (_queue.isEmpty() && directoriesPending() == 0) {
+        finish(false);
+    }
+}
+
+void FtpTreeWalker::abandon()
+{
+    // Соединений не осталось, а новые уже не открываются: оставшиеся
+    // каталоги прочитать некому.
+    const QString error = _error.isEmpty() ? tr("Connection to the server lost") : _error;
+    const QQueue<Item> queue = _queue;
+    _queue.clear();
+    for (const auto &item : queue) {
+        emit directoryFailed(item.path, error);
+        if (!_running) {
+            return;
+        }
+    }
+    finish(true);
+}
+
+void FtpTreeWalker::openSession()
+{
+    Session session;
+    QFtp *ftp = new QFtp(this);
+    session.ftp = ftp;
+    ftp->setFastAbort(true);
+    connect(ftp, &QFtp::listEntryBatch, this, [this, ftp](const QVector<FtpDirEntry> &entries) {
+        batchReceived(sessionOf(ftp), entries);
+    });
+    connect(ftp, &QFtp::listTreeBatch, this, &FtpTreeWalker::treeBatchReceived);
+    connect(ftp, &QFtp::commandFinished, this, [this, ftp](int id, bool error) {
+        const int s = sessionOf(ftp);
+        if (s < 0) {
+            return;
+        }
+        if (id == _sessions.at(s).listId) {
+            listFinished(s, error);
+        } else if (error) {
+            // Не удалось подключиться или войти: каталог отдаём другим.
+            _error = _sessions.at(s).ftp->errorString();
+            ++_failedSessions;
+            if (_sessions.at(s).listId != 0) {
+                _queue.prepend(_sessions.at(s).item);
+            }
+            closeSession(s);
+            schedule();
+        }
+    });
+    ftp->connectToHost(_host, _port);
+    ftp->login(_user, _password);
+    session.item = _queue.dequeue();
+    session.listId = session.item.tree ? ftp->listRecursive(session.item.path) : ftp->list(session.item.path);
+    _sessions.append(session);
+}
+
+void FtpTreeWalker::closeSession(int s)
+{
+    QFtp *ftp = _sessions.at(s).ftp;
+    ftp->disconnect(this);
+    ftp->abort();
+    ftp->deleteLater();
+    _sessions.remove(s);
+}
+
+int FtpTreeWalker::sessionOf(QFtp *ftp) const
+{
+    for (int s = 0; s < _sessions.size(); ++s) {
+        if (_sessions.at(s).ftp == ftp) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+void FtpTreeWalker::batchReceived(int s, const QVector<FtpDirEntry> &entries)
+{
+    if (s < 0) {
+        return;
+    }
+    Session &session = _sessions[s];
+    for (const auto &entry : entries) {
+        session.fingerprint = session.fingerprint * 31
+                + (qHash(entry.name()) ^ qHash(entry.size()) ^ qHash(entry.lastModifiedSecs()));
+    }
+    session.entries += entries;
+    if (session.item.viaLink) {
+        // До проверки на петлю ничего не отдаём.
+        return;
+    }
+    const QVector<FtpDirEntry> found = filtered(session.item.path, entries);
+    if (!found.isEmpty()) {
+        emit entriesFound(session.item.path, found);
+    }
+}
+
+void FtpTreeWalker::treeBatchReceived(const QString &dir, const QVector<FtpDirEntry> &entries)
+{
+    // Заголовки идут сверху вниз, так что родитель уже известен.
+    const int slash = dir.lastIndexOf(QLatin1Char('/'));
+    if (_treeExcluded.contains(dir) || (slash > 0 && _treeExcluded.contains(dir.left(slash)))) {
+        _treeExcluded.insert(dir);
+        return;
+    }
+    if (dir != _treeLast) {
+        flushTreeHeld();
+        if (!_running) {
+            return;
+        }
+    }
+    _treeListed.insert(dir);
+    _treeLast = dir;
+    for (const auto &entry : entries) {
+        const QString &entryName = entry.name();
+        if (!entry.isDir() || entryName == QLatin1String(".") || entryName == QLatin1String("..")) {
+            continue;
+        }
+        const QString path = childPath(dir, entryName);
+        if (matches(_exclude, _excludeRe, entryName, path)) {
+            _treeExcluded.insert(path);
+        } else if (!entry.isSymLink()) {
+            _treeDirs.insert(path);
+        } else if (_followSymLinks) {
+            _treeLinks.append(path);
+        }
+    }
+    _treeHeld += filtered(dir, entries);
+}
+
+void FtpTreeWalker::flushTreeHeld()
+{
+    if (_treeHeld.isEmpty()) {
+        return;
+    }
+    QVector<FtpDirEntry> found;
+    found.swap(_treeHeld);
+    emit entriesFound(_treeLast, found);
+}
+
+void FtpTreeWalker::clearTree()
+{
+    _treeListed.clear();
+    _treeDirs.clear();
+    _treeExcluded.clear();
+    _treeLinks.clear();
+    _treeLast.clear();
+    _treeHeld.clear();
+}
+
+void FtpTreeWalker::treeFinished(const Item &item, bool error)
+{
+    if (error) {
+        // LIST -R не поддерживается: обычный обход с того же корня.
+        Item walk = item;
+        walk.tree = false;
+        _queue.enqueue(walk);
+    } else {
+        // Ответ пришёл целиком: придержанный последний каталог тоже отдаём.
+        flushTreeHeld();
+        if (!_running) {
+            return;
+        }
+        // Каталоги, не попавшие в ответ, дочитываем по одному. Если
+        // их родитель сам будет перечитан, он их и найдёт.
+        for (const auto &path : qAsConst(_treeDirs)) {
+            const int slash = path.lastIndexOf(QLatin1Char('/'));
+            if (!_treeListed.contains(path) && _treeListed.contains(path.left(qMax(slash, 1)))) {
+                Item child;
+                child.path = path;
+                _queue.enqueue(child);
+            }
+        }
+        for (const auto &path : qAsConst(_treeLinks)) {
+            Item child;
+            child.path = path;
+            child.isLink = true;
+            child.viaLink = true;
+            _queue.enqueue(child);
+        }
+        _listed += _treeListed.size();
+    }
+    clearTree();
+    schedule();
+}
+
+void FtpTreeWalker::listFinished(int s, bool error)
+{
+    Session &session = _sessions[s];
+    const Item item = session.item;
+    QVector<FtpDirEntry> entries;
+    entries.swap(session.entries);
+    const uint fingerprint = session.fingerprint;
+    session.listId = 0;
+
+    if (error) {
+        if (session.ftp->state() == QFtp::Unconnected && item.tree) {
+            // Обрыв посреди LIST -R: принятое оставляем, последний
+            // каталог и непрочитанное дочитываем обычным обходом.
+            _error = session.ftp->errorString();
+            closeSession(s);
+            _treeListed.remove(_treeLast);
+            _treeHeld.clear();
+            treeFinished(item, _treeListed.isEmpty());
+        } else if (item.tree) {
+            treeFinished(item, true);
+        } else if (session.ftp->state() == QFtp::Unconnected) {
+            // Соединение потеряно: каталог пробуем ещё раз на другом.
+            _error = session.ftp->errorString();
+            closeSession(s);
+            if (item.retries == 0) {
+                Item retry = item;
+                retry.retries = 1;
+                _queue.prepend(retry);
+            } else {
+                emit directoryFailed(item.path, _error);
+            }
+        } else {
+            emit directoryFailed(item.path, session.ftp->errorString());
+        }
+        schedule();
+        return;
+    }
+    if (item.tree) {
+        treeFinished(item, false);
+        return;
+    }
+    ++_listed;
+
+    const bool descend = _maxDepth < 0 || item.depth < _maxDepth;
+    if (item.viaLink) {
+        // LIST ссылки на файл возвращает сам файл.
+        const QString base = item.path.mid(item.path.lastIndexOf(QLatin1Char('/')) + 1);
+        if (item.isLink && entries.size() == 1 && !entries.first().isDir()
+                && (entries.first().name() == base || entries.first().name() == item.path)) {
+            schedule();
+            return;
+        }
+        if (item.ancestry.contains(fingerprint)) {
+            // Петля: такой листинг уже был выше по пути.
+            schedule();
+            return;
+        }
+        const QVector<FtpDirEntry> found = filtered(item.path, entries);
+        if (!found.isEmpty()) {
+            emit entriesFound(item.path, found);
+            if (!_running) {
+                return;
+            }
+        }
+    }
+
+    if (descend) {
+        QVector<uint> ancestry = item.ancestry;
+        ancestry.append(fingerprint);
+        for (const auto &entry : qAsConst(entries)) {
+            const QString &name = entry.name();
+            if (!entry.isDir() || name == QLatin1String(".") || name == QLatin1String("..")) {
+                continue;
+            }
+            if (entry.isSymLink() && !_followSymLinks) {
+                continue;
+            }
+            Item child;
+            child.path = childPath(item.path, name);
+            if (matches(_exclude, _excludeRe, name, child.path)) {
+                continue;
+            }
+            child.depth = item.depth + 1;
+            child.isLink = entry.isSymLink();
+            child.viaLink = item.viaLink || child.isLink;
+            child.ancestry = ancestry;
+            _queue.enqueue(child);
+        }
+    }
+    schedule();
+}
+
+void FtpTreeWalker::finish(bool error)
+{
+    _queue.clear();
+    for (int s = _sessions.size() - 1; s >= 0; --s) {
+        closeSession(s);
+    }
+    _running = false;
+    emit finished(error);
+}
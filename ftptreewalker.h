@@ -0,0 +1,146 @@
+#pragma once
+
+#include <QObject>
+#include <QQueue>
+#include <QRegularExpression>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+#include <ftpdirentry.h>
+
+class QFtp;
+
+// Обход дерева каталогов сервера на нескольких соединениях.
+// Каталоги берутся из общей очереди (в ширину), каждое соединение
+// читает свой LIST <путь> без cd, так что одновременно идут
+// concurrency() листингов. Записи отдаются сигналом entriesFound()
+// пачками по мере разбора.
+//
+// Фильтры - маски с * и ?; маска со '/' сравнивается с полным путём,
+// без - с именем. Исключённые записи не отдаются, исключённые каталоги
+// не обходятся. Маски включения отбирают отдаваемые записи, но в
+// каталоги, не подошедшие под них, обход всё равно заходит.
+//
+// Символьные ссылки LIST показывает как каталоги. По умолчанию в них
+// не заходим. С followSymLinks() заходим, но каталог, попавший в обход
+// через ссылку, не обходится дальше, если его листинг совпал с листингом
+// одного из предков - это и есть петля.
+//
+// С recursiveListing() обход без ограничения глубины начинается с одного
+// LIST -R корня (QFtp::listRecursive()): дерево приходит за один запрос.
+// Подкаталоги, которых не оказалось в ответе (сервер не знает -R, ссылки
+// при followSymLinks()), дочитываются обычным обходом; если LIST -R не
+// удался, обычным обходом читается всё дерево.
+class FtpTreeWalker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FtpTreeWalker(QObject *parent = nullptr);
+    ~FtpTreeWalker() override;
+
+    void setSession(const QString &host, quint16 port, const QString &user, const QString &password);
+
+    int concurrency() const;
+    void setConcurrency(int sessions);
+    // Глубина обхода: 0 - только root, -1 - без ограничения.
+    int maxDepth() const;
+    void setMaxDepth(int depth);
+    QStringList includePatterns() const;
+    void setIncludePatterns(const QStringList &patterns);
+    QStringList excludePatterns() const;
+    void setExcludePatterns(const QStringList &patterns);
+    bool followSymLinks() const;
+    void setFollowSymLinks(bool follow);
+    bool recursiveListing() const;
+    void setRecursiveListing(bool enabled);
+
+    bool isRunning() const;
+    int directoriesListed() const;
+    int directoriesPending() const;
+    QString errorString() const;
+
+public slots:
+    void start(const QString &root);
+    void abort();
+
+signals:
+    // dir - полный путь каталога, которому принадлежат записи.
+    void entriesFound(const QString &dir, const QVector<FtpDirEntry> &entries);
+    void directoryFailed(const QString &dir, const QString &error);
+    void finished(bool error);
+
+private:
+    struct Item {
+        QString path;
+        int depth = 0;
+        // Каталог достигнут через символьную ссылку.
+        bool viaLink = false;
+        // Сам каталог - ссылка.
+        bool isLink = false;
+        // Отпечатки листингов предков, от корня.
+        QVector<uint> ancestry;
+        int retries = 0;
+        // Читать LIST -R.
+        bool tree = false;
+    };
+
+    struct Session {
+        QFtp *ftp = nullptr;
+        int listId = 0;
+        Item item;
+        QVector<FtpDirEntry> entries;
+        uint fingerprint = 0;
+    };
+
+    void schedule();
+    void openSession();
+    void closeSession(int s);
+    void finish(bool error);
+    void abandon();
+    int sessionOf(QFtp *ftp) const;
+    void batchReceived(int s, const QVector<FtpDirEntry> &entries);
+    void treeBatchReceived(const QString &dir, const QVector<FtpDirEntry> &entries);
+    void listFinished(int s, bool error);
+    void treeFinished(const Item &item, bool error);
+    void flushTreeHeld();
+    void clearTree();
+    static bool matches(const QStringList &globs, const QVector<QRegularExpression> &patterns,
+                        const QString &name, const QString &path);
+    QVector<FtpDirEntry> filtered(const QString &dir, const QVector<FtpDirEntry> &entries) const;
+    static QString childPath(const QString &dir, const QString &name);
+    static QVector<QRegularExpression> compile(const QStringList &patterns);
+
+    QString _host;
+    quint16 _port = 21;
+    QString _user;
+    QString _password;
+
+    int _concurrency = 4;
+    int _maxDepth = -1;
+    QStringList _include;
+    QStringList _exclude;
+    QVector<QRegularExpression> _includeRe;
+    QVector<QRegularExpression> _excludeRe;
+    bool _followSymLinks = false;
+    bool _recursiveListing = false;
+    // Ответ LIST -R: прочитанные и найденные в нём каталоги, исключённые
+    // вместе с их поддеревом, и ссылки, в которые надо зайти отдельно.
+    QSet<QString> _treeListed;
+    QSet<QString> _treeDirs;
+    QSet<QString> _treeExcluded;
+    QStringList _treeLinks;
+    // Последний каталог ответа; при обрыве он мог прийти не целиком.
+    // Поэтому его записи придерживаются до следующего заголовка или до
+    // конца ответа, а при обрыве отбрасываются и читаются заново.
+    QString _treeLast;
+    QVector<FtpDirEntry> _treeHeld;
+
+    bool _running = false;
+    QQueue<Item> _queue;
+    QVector<Session> _sessions;
+    // Соединения, которые не удалось открыть; после concurrency() таких
+    // новых не открываем.
+    int _failedSessions = 0;
+    int _listed = 0;
+    QString _error;
+};
@@ -50,18 +50,74 @@
 #include "qcoreapplication.h"
 #include "qtcpsocket.h"
 #include "qurlinfo.h"
+#include "ftpdirsnapshot.h"
 #include "qstringlist.h"
 #include "qregexp.h"
 #include "qtimer.h"
+#include "qelapsedtimer.h"
 #include "qfileinfo.h"
 #include "qhash.h"
+#include "qset.h"
+#include "qmetaobject.h"
 #include "qtcpserver.h"
 #include "qlocale.h"
+#include "qthread.h"
+#include "qfuturewatcher.h"
+#include "qtconcurrentmap.h"
+
+#include "qftplinescan_p.h"
 
 QT_BEGIN_NAMESPACE
 
 class QFtpPI;
 
+/*
+    Nearly every entry of a listing repeats the same few owner and group
+    names. The pool hands out one implicitly shared copy per distinct
+    value, so the parsed entries do not each keep their own strings.
+*/
+class QFtpStringPool
+{
+public:
+    QString intern(const QString &s)
+    {
+        QSet<QString>::const_iterator it = strings.constFind(s);
+        if (it != strings.constEnd())
+            return *it;
+        // a listing with this many distinct names gains nothing from
+        // the pool; start over rather than grow without bound
+        if (strings.size() >= 4096)
+            strings.clear();
+        strings.insert(s);
+        return s;
+    }
+
+    void clear() { strings.clear(); }
+
+private:
+    QSet<QString> strings;
+};
+
+/*
+    A line aligned slice of a LIST payload. When large listings are
+    parsed on the thread pool, all slices share the receive buffer, so
+    cutting the payload into slices does not copy it.
+*/
+struct QFtpListChunk
+{
+    QByteArray data;
+    int begin;
+    int end;
+    bool wantUrlInfo;
+};
+
+struct QFtpListChunkResult
+{
+    QVector<FtpDirEntry> entries;
+    QVector<QUrlInfo> infos;
+    QString err;
+};
+
 /*
     The QFtpDTP (DTP = Data Transfer Process) controls all client side
     data transfer between the client and server.
@@ -101,10 +157,28 @@ public:
 
     void abortConnection();
 
-    static bool parseDir(const QByteArray &buffer, const QString &userName, QUrlInfo *info);
+    void setListParseThreshold(qint64 bytes);
+    qint64 listParseThreshold() const;
+    void setStallDetection(qint64 minBytesPerSecond, int windowMsecs);
+    qint64 stallRateFloor() const { return stallFloor; }
+    int stallWindow() const { return stallWindowMsecs; }
+    bool hasStalled() const { return stalled; }
+    void setUrlInfoWanted(bool wanted) { urlInfoWanted = wanted; }
+    // owner and group names are per server; drop them between sessions
+    void clearStringPool() { listStrings.clear(); }
+    void setSnapshot(FtpDirSnapshot *s) { snapshot = s; }
+    void setListTree(bool tree, const QString &root);
+
+    static bool parseDir(const QByteArray &buffer, const QString &userName, FtpDirEntry *info,
+                         QFtpStringPool *strings = 0);
+    static bool parseDir(const QByteArray &buffer, const QString &userName, QUrlInfo *info,
+                         QFtpStringPool *strings = 0);
 
 signals:
     void listInfo(const QUrlInfo&);
+    void listInfoBatch(const QVector<QUrlInfo>&);
+    void listEntryBatch(const QVector<FtpDirEntry>&);
+    void listTreeBatch(const QString&, const QVector<FtpDirEntry>&);
     void readyRead();
     void dataTransferProgress(qint64, qint64);
 
@@ -120,9 +194,21 @@ private slots:
 
     void dataReadyRead();
 
+    void listParseFinished();
+
+    void checkStall();
+
 private:
     void clearData();
 
+    void startStallCheck();
+    qint64 transferredBytes() const;
+
+    void resetListParsing();
+    bool startListParsing();
+    bool parseTreeHeader(const QByteArray &line, QString *dir) const;
+    static QFtpListChunkResult parseListChunk(const QFtpListChunk &chunk);
+
     QTcpSocket *socket;
     QTcpServer listener;
 
@@ -141,6 +227,47 @@ private:
     bool is_ba;
 
     QByteArray bytesFromSocket;
+
+    // Listings larger than listThreshold bytes are collected in
+    // listBuffer and parsed on the thread pool; 0 disables this.
+    qint64 listThreshold;
+    qint64 listBytesReceived;
+    bool listParallel;
+    bool listClosePending;
+    int listGeneration;
+    QByteArray listBuffer;
+    QFutureWatcher<QFtpListChunkResult> listWatcher;
+
+    // owner and group names shared by all listings of the session
+    QFtpStringPool listStrings;
+
+    // QUrlInfo objects are only built while someone listens for them
+    bool urlInfoWanted;
+    // if set, the listing is stored here and no signals are emitted
+    FtpDirSnapshot *snapshot;
+
+    // LIST -R: the payload is a sequence of "path:" headers, each
+    // followed by the entries of that directory. listTreeDir is the
+    // directory the entries currently being parsed belong to.
+    bool listTree;
+    QString listTreeRoot;
+    QString listTreeDir;
+    // listTreeDir was named by a header and has no entries yet
+    bool listTreeDirEmpty;
+
+    // A transfer whose moving average rate stays below stallFloor bytes
+    // per second for stallWindowMsecs is torn down; a floor of 0
+    // disables the check.
+    qint64 stallFloor;
+    int stallWindowMsecs;
+    QTimer stallTimer;
+    QElapsedTimer stallClock;
+    qint64 stallLastBytes;
+    qint64 stallLastTime;
+    qint64 stallBelowSince;
+    double stallRate;
+    // the last data connection was torn down by the check
+    bool stalled;
 };
 
 /**********************************************************************
@@ -164,6 +291,10 @@ public:
 
     void clearPendingCommands();
     void abort();
+    void fastAbort();
+
+    void setFastAbortGrace(int msecs) { fastAbortGrace = msecs; }
+    int fastAbortGracePeriod() const { return fastAbortGrace; }
 
     QString currentCommand() const
         { return currentCmd; }
@@ -178,6 +309,7 @@ signals:
     void finished(const QString&);
     void error(int, const QString&);
     void rawFtpReply(int, const QString&);
+    void aborted();
 
 private slots:
     void hostFound();
@@ -189,6 +321,8 @@ private slots:
 
     void dtpConnectState(int);
 
+    void fastAbortTimeout();
+
 private:
     // the states are modelled after the generalized state diagram of RFC 959,
     // page 58
@@ -209,6 +343,10 @@ private:
     bool processReply();
     bool startNextCmd();
 
+    void readAbortReplies();
+    void rememberSessionCommand();
+    void recoveryFailed(int code, const QString &text);
+
     QTcpSocket commandSocket;
     QString replyText;
     char replyCode[3];
@@ -222,6 +360,22 @@ private:
 
     QByteArray bytesFromSocket;
 
+    // Fast abort: if ABOR gets no clean reply within fastAbortGrace ms,
+    // the control connection is replaced by a new one, which replays
+    // the commands below to restore the session. A negative grace
+    // period selects the classic abort().
+    int fastAbortGrace;
+    QTimer fastAbortTimer;
+    // final replies still due after a fast ABOR: one for the running
+    // command (unless it has already arrived) and one for ABOR itself
+    int abortRepliesPending;
+    bool recovering;
+    QString sessionHost;
+    quint16 sessionPort;
+    QStringList loginCmds;
+    QString typeCmd;
+    QStringList cwdCmds;
+
     friend class QFtpDTP;
 };
 
@@ -241,6 +395,12 @@ public:
     QFtp::Command command;
     QStringList rawCmds;
 
+    // List only: the entries go here instead of the listing signals.
+    FtpDirSnapshot *snapshot;
+    // List only: LIST -R of treeRoot, reported through listTreeBatch().
+    bool tree;
+    QString treeRoot;
+
     // If is_ba is true, ba is used; ba is never 0.
     // Otherwise dev is used; dev can be 0 or not.
     union {
@@ -255,14 +415,14 @@ public:
 QBasicAtomicInt QFtpCommand::idCounter = Q_BASIC_ATOMIC_INITIALIZER(1);
 
 QFtpCommand::QFtpCommand(QFtp::Command cmd, QStringList raw, const QByteArray &ba)
-    : command(cmd), rawCmds(raw), is_ba(true)
+    : command(cmd), rawCmds(raw), snapshot(0), tree(false), is_ba(true)
 {
     id = idCounter.fetchAndAddRelaxed(1);
     data.ba = new QByteArray(ba);
 }
 
 QFtpCommand::QFtpCommand(QFtp::Command cmd, QStringList raw, QIODevice *dev)
-    : command(cmd), rawCmds(raw), is_ba(false)
+    : command(cmd), rawCmds(raw), snapshot(0), tree(false), is_ba(false)
 {
     id = idCounter.fetchAndAddRelaxed(1);
     data.dev = dev;
@@ -284,11 +444,29 @@ QFtpDTP::QFtpDTP(QFtpPI *p, QObject *parent) :
     socket(0),
     listener(this),
     pi(p),
-    callWriteData(false)
+    callWriteData(false),
+    listThreshold(0),
+    listBytesReceived(0),
+    listParallel(false),
+    listClosePending(false),
+    listGeneration(0),
+    urlInfoWanted(false),
+    snapshot(0),
+    listTree(false),
+    listTreeDirEmpty(false),
+    stallFloor(0),
+    stallWindowMsecs(10000),
+    stallLastBytes(0),
+    stallLastTime(0),
+    stallBelowSince(-1),
+    stallRate(-1),
+    stalled(false)
 {
     clearData();
     listener.setObjectName(QLatin1String("QFtpDTP active state server"));
     connect(&listener, SIGNAL(newConnection()), SLOT(setupSocket()));
+    connect(&listWatcher, SIGNAL(finished()), SLOT(listParseFinished()));
+    connect(&stallTimer, SIGNAL(timeout()), SLOT(checkStall()));
 }
 
 void QFtpDTP::setData(QByteArray *ba)
@@ -313,6 +491,8 @@ void QFtpDTP::setBytesTotal(qint64 bytes)
 void QFtpDTP::connectToHost(const QString & host, quint16 port)
 {
     bytesFromSocket.clear();
+    resetListParsing();
+    stallTimer.stop();
 
     if (socket) {
         delete socket;
@@ -355,6 +535,10 @@ void QFtpDTP::waitForConnection()
 
 QTcpSocket::SocketState QFtpDTP::state() const
 {
+    // The listing is not complete until the pool has parsed the tail of
+    // it, so keep the PI waiting for CsClosed until then.
+    if (listClosePending)
+        return QTcpSocket::ClosingState;
     return socket ? socket->state() : QTcpSocket::UnconnectedState;
 }
 
@@ -461,11 +645,249 @@ void QFtpDTP::abortConnection()
 #endif
     callWriteData = false;
     clearData();
+    resetListParsing();
+    stallTimer.stop();
 
     if (socket)
         socket->abort();
 }
 
+void QFtpDTP::setStallDetection(qint64 minBytesPerSecond, int windowMsecs)
+{
+    stallFloor = qMax(qint64(0), minBytesPerSecond);
+    stallWindowMsecs = qMax(0, windowMsecs);
+    if (stallFloor == 0)
+        stallTimer.stop();
+}
+
+/*
+  Everything received or sent on the current data connection, including
+  data that is still waiting in the socket to be read by the user.
+*/
+qint64 QFtpDTP::transferredBytes() const
+{
+    return bytesDone + listBytesReceived + (socket ? socket->bytesAvailable() : 0);
+}
+
+void QFtpDTP::startStallCheck()
+{
+    stalled = false;
+    if (stallFloor == 0)
+        return;
+    stallClock.start();
+    stallLastBytes = transferredBytes();
+    stallLastTime = 0;
+    stallBelowSince = -1;
+    stallRate = -1;
+    // a few samples per window, but not more often than needed
+    stallTimer.start(qBound(100, stallWindowMsecs / 4, 1000));
+}
+
+void QFtpDTP::checkStall()
+{
+    if (!socket || socket->state() != QTcpSocket::ConnectedState) {
+        stallTimer.stop();
+        return;
+    }
+    const qint64 now = stallClock.elapsed();
+    const qint64 elapsed = now - stallLastTime;
+    if (elapsed <= 0)
+        return;
+    const qint64 bytes = transferredBytes();
+    const double rate = (bytes - stallLastBytes) * 1000.0 / elapsed;
+    stallRate = stallRate < 0 ? rate : (stallRate + rate) / 2;
+    stallLastBytes = bytes;
+    stallLastTime = now;
+
+    if (stallRate >= stallFloor) {
+        stallBelowSince = -1;
+        return;
+    }
+    if (stallBelowSince < 0)
+        stallBelowSince = now - elapsed;
+    if (now - stallBelowSince < stallWindowMsecs)
+        return;
+
+#if defined(QFTPDTP_DEBUG)
+    qDebug("QFtpDTP::checkStall: %.0f bytes/s for %lli ms, aborting", stallRate, now - stallBelowSince);
+#endif
+    // Only the data connection is dropped. The server answers that on
+    // the control connection, and the PI reports err for the command
+    // whether the reply is a failure or a late success.
+    err = QFtp::tr("Data transfer stalled: less than %1 bytes/s for %2 s")
+            .arg(stallFloor).arg(stallWindowMsecs / 1000.0);
+    stalled = true;
+    abortConnection();
+}
+
+void QFtpDTP::setListParseThreshold(qint64 bytes)
+{
+    listThreshold = qMax(qint64(0), bytes);
+}
+
+qint64 QFtpDTP::listParseThreshold() const
+{
+    return listThreshold;
+}
+
+void QFtpDTP::resetListParsing()
+{
+    if (listWatcher.isRunning()) {
+        listWatcher.cancel();
+        listWatcher.waitForFinished();
+    }
+    listBuffer.clear();
+    listBytesReceived = 0;
+    listParallel = false;
+    listClosePending = false;
+    ++listGeneration;
+    listTreeDir = listTreeRoot;
+    listTreeDirEmpty = false;
+}
+
+void QFtpDTP::setListTree(bool tree, const QString &root)
+{
+    listTree = tree;
+    listTreeRoot = root;
+    listTreeDir = root;
+    listTreeDirEmpty = false;
+}
+
+/*
+  Recognizes the "path:" line that starts a directory block of a LIST -R
+  listing. Servers print the path as given (vsftpd: "/pub/sub:"), or
+  relative to the listed directory (ProFTPD: "./sub:" or "sub:", with
+  ".:" for the directory itself); all forms are resolved against the
+  directory passed to listRecursive().
+*/
+bool QFtpDTP::parseTreeHeader(const QByteArray &line, QString *dir) const
+{
+    QString header = QString::fromLatin1(line).trimmed();
+    if (!header.endsWith(QLatin1Char(':')))
+        return false;
+    header.chop(1);
+    if (header.isEmpty() || header == QLatin1String(".")) {
+        *dir = listTreeRoot;
+        return true;
+    }
+    if (header.startsWith(QLatin1String("./"))) {
+        header = header.mid(2);
+    } else if (header.startsWith(QLatin1Char('/')) || listTreeRoot.isEmpty() || header == listTreeRoot
+               || header.startsWith(listTreeRoot + QLatin1Char('/'))) {
+        *dir = header;
+        return true;
+    }
+    if (listTreeRoot.isEmpty())
+        *dir = header;
+    else if (listTreeRoot.endsWith(QLatin1Char('/')))
+        *dir = listTreeRoot + header;
+    else
+        *dir = listTreeRoot + QLatin1Char('/') + header;
+    return true;
+}
+
+/*
+  Hands all complete lines collected in listBuffer to the thread pool.
+  Returns false if there was nothing to parse or a batch is still running.
+*/
+bool QFtpDTP::startListParsing()
+{
+    if (listWatcher.isRunning())
+        return false;
+
+    const int end = listBuffer.lastIndexOf('\n') + 1;
+    if (end <= 0)
+        return false;
+
+    QByteArray payload = listBuffer;
+    listBuffer = listBuffer.mid(end);
+
+    // Small slices keep all pool threads busy until the end of the batch.
+    const int chunkSize = 256 * 1024;
+    QList<QFtpListChunk> chunks;
+    int begin = 0;
+    while (begin < end) {
+        int stop = qMin(begin + chunkSize, end);
+        if (stop < end)
+            stop = payload.indexOf('\n', stop - 1) + 1;
+        QFtpListChunk chunk = { payload, begin, stop, urlInfoWanted && !snapshot };
+        chunks.append(chunk);
+        begin = stop;
+    }
+
+#if defined(QFTPDTP_DEBUG)
+    qDebug("QFtpDTP parsing %d bytes of listing in %d chunks", end, chunks.size());
+#endif
+    listWatcher.setFuture(QtConcurrent::mapped(chunks, parseListChunk));
+    return true;
+}
+
+QFtpListChunkResult QFtpDTP::parseListChunk(const QFtpListChunk &chunk)
+{
+    QFtpListChunkResult result;
+    // The session pool belongs to the GUI thread. One pool per chunk
+    // still leaves only a handful of copies of each name per listing.
+    QFtpStringPool strings;
+    const char *pos = chunk.data.constData() + chunk.begin;
+    const char *end = chunk.data.constData() + chunk.end;
+    while (pos < end) {
+        const char *next = _q_findNewline(pos, end) + 1;
+        const QByteArray line = QByteArray::fromRawData(pos, int(next - pos));
+        pos = next;
+
+        FtpDirEntry entry;
+        if (parseDir(line, QLatin1String(""), &entry, &strings)) {
+            if (chunk.wantUrlInfo)
+                result.infos.append(entry.toUrlInfo());
+            result.entries.append(entry);
+        } else if (line.endsWith("No such file or directory\r\n"))
+            result.err = QString::fromLatin1(line);
+    }
+    return result;
+}
+
+void QFtpDTP::listParseFinished()
+{
+    if (!listParallel || listWatcher.isCanceled())
+        return;
+    const int generation = listGeneration;
+
+    // mapped() keeps the results in the order of the chunks, so the
+    // entries are delivered in the order the server sent them.
+    const QFuture<QFtpListChunkResult> future = listWatcher.future();
+    for (int n = 0; n < future.resultCount(); ++n) {
+        const QFtpListChunkResult result = future.resultAt(n);
+        if (!result.err.isEmpty())
+            err = result.err;
+        if (snapshot) {
+            for (const FtpDirEntry &entry : result.entries)
+                snapshot->append(entry);
+            continue;
+        }
+        for (const QUrlInfo &i : result.infos)
+            emit listInfo(i);
+        if (!result.entries.isEmpty())
+            emit listEntryBatch(result.entries);
+        if (!result.infos.isEmpty())
+            emit listInfoBatch(result.infos);
+        // the slots may have aborted the transfer
+        if (generation != listGeneration)
+            return;
+    }
+
+    if (startListParsing())
+        return;
+
+    if (listClosePending) {
+        listClosePending = false;
+        listParallel = false;
+#if defined(QFTPDTP_DEBUG)
+        qDebug("QFtpDTP::connectState(CsClosed)");
+#endif
+        emit connectState(QFtpDTP::CsClosed);
+    }
+}
+
 static void _q_fixupDateTime(QDateTime *dateTime)
 {
     // Adjust for future tolerance.
@@ -477,7 +899,8 @@ static void _q_fixupDateTime(QDateTime *dateTime)
     }
 }
 
-static void _q_parseUnixDir(const QStringList &tokens, const QString &userName, QUrlInfo *info)
+static void _q_parseUnixDir(const QStringList &tokens, const QString &userName, FtpDirEntry *info,
+                            QFtpStringPool *strings)
 {
     // Unix style, 7 + 1 entries
     // -rw-r--r--    1 ftp      ftp      17358091 Aug 10  2004 qt-x11-free-3.3.3.tar.gz
@@ -511,8 +934,13 @@ static void _q_parseUnixDir(const QStringList &tokens, const QString &userName,
     info->setName(name);
 
     // Resolve owner & group
-    info->setOwner(tokens.at(3));
-    info->setGroup(tokens.at(4));
+    if (strings) {
+        info->setOwner(strings->intern(tokens.at(3)));
+        info->setGroup(strings->intern(tokens.at(4)));
+    } else {
+        info->setOwner(tokens.at(3));
+        info->setGroup(tokens.at(4));
+    }
 
     // Resolve size
     info->setSize(tokens.at(5).toLongLong());
@@ -540,8 +968,11 @@ static void _q_parseUnixDir(const QStringList &tokens, const QString &userName,
                                dateTime.date().day()));
         _q_fixupDateTime(&dateTime);
     }
-    if (dateTime.isValid())
+    if (dateTime.isValid()) {
         info->setLastModified(dateTime);
+        // The year formats carry no time of day.
+        info->setDateOnly(n != 2 && n != 4);
+    }
 
     // Resolve permissions
     int permissions = 0;
@@ -562,7 +993,7 @@ static void _q_parseUnixDir(const QStringList &tokens, const QString &userName,
     info->setWritable((permissions & QUrlInfo::WriteOther) || ((permissions & QUrlInfo::WriteOwner) && isOwner));
 }
 
-static void _q_parseDosDir(const QStringList &tokens, const QString &userName, QUrlInfo *info)
+static void _q_parseDosDir(const QStringList &tokens, const QString &userName, FtpDirEntry *info)
 {
     // DOS style, 3 + 1 entries
     // 01-16-02  11:14AM       <DIR>          epsgroup
@@ -615,7 +1046,18 @@ static void _q_parseDosDir(const QStringList &tokens, const QString &userName, Q
 
 }
 
-bool QFtpDTP::parseDir(const QByteArray &buffer, const QString &userName, QUrlInfo *info)
+bool QFtpDTP::parseDir(const QByteArray &buffer, const QString &userName, QUrlInfo *info,
+                       QFtpStringPool *strings)
+{
+    FtpDirEntry entry;
+    if (!parseDir(buffer, userName, &entry, strings))
+        return false;
+    *info = entry.toUrlInfo();
+    return true;
+}
+
+bool QFtpDTP::parseDir(const QByteArray &buffer, const QString &userName, FtpDirEntry *info,
+                       QFtpStringPool *strings)
 {
     if (buffer.isEmpty())
         return false;
@@ -626,7 +1068,7 @@ bool QFtpDTP::parseDir(const QByteArray &buffer, const QString &userName, QUrlIn
     QRegExp unixPattern(QLatin1String("^([\\-dl])([a-zA-Z\\-]{9,9})\\s+\\d+\\s+(\\S*)\\s+"
                                       "(\\S*)\\s+(\\d+)\\s+(\\S+\\s+\\S+\\s+\\S+)\\s+(\\S.*)"));
     if (unixPattern.indexIn(bufferStr) == 0) {
-        _q_parseUnixDir(unixPattern.capturedTexts(), userName, info);
+        _q_parseUnixDir(unixPattern.capturedTexts(), userName, info, strings);
         return true;
     }
 
@@ -645,6 +1087,7 @@ bool QFtpDTP::parseDir(const QByteArray &buffer, const QString &userName, QUrlIn
 void QFtpDTP::socketConnected()
 {
     bytesDone = 0;
+    startStallCheck();
 #if defined(QFTPDTP_DEBUG)
     qDebug("QFtpDTP::connectState(CsConnected)");
 #endif
@@ -671,15 +1114,75 @@ void QFtpDTP::socketReadyRead()
         return;
     }
 
-    if (pi->currentCommand().startsWith(QLatin1String("LIST"))) {
-        while (socket->canReadLine()) {
-            QUrlInfo i;
-            QByteArray line = socket->readLine();
+    // listRaw() passes the listing to its device like a download
+    if (pi->currentCommand().startsWith(QLatin1String("LIST")) && (is_ba || !data.dev)) {
+        // A recursive listing is parsed in order: which directory an
+        // entry belongs to depends on the headers before it.
+        if (listThreshold > 0 && !listTree
+                && (listParallel || listBytesReceived + socket->bytesAvailable() >= listThreshold)) {
+            // Large listing: collect the payload and parse it on the
+            // thread pool, a batch of lines at a time.
+            listParallel = true;
+            const QByteArray ba = socket->readAll();
+            listBytesReceived += ba.size();
+            listBuffer.append(ba);
+            if (listBuffer.size() >= 256 * 1024 * QThread::idealThreadCount())
+                startListParsing();
+            return;
+        }
+
+        // Frame the lines in place: the parser gets views into one
+        // buffer, and only an incomplete last line is kept for the next
+        // chunk. The buffer is moved to a local, so that a slot that
+        // aborts the transfer cannot free it while it is being parsed.
+        const QByteArray ba = socket->readAll();
+        listBytesReceived += ba.size();
+        listBuffer.append(ba);
+        QByteArray buffer;
+        buffer.swap(listBuffer);
+        const int generation = listGeneration;
+        const char *begin = buffer.constData();
+        const char *end = begin + buffer.size();
+        const char *pos = begin;
+
+        // Everything parsed from this chunk is also delivered at once
+        // through listEntryBatch() and listInfoBatch(), which is much
+        // cheaper than one signal per entry when the receiver lives in
+        // another thread.
+        const bool wantUrlInfo = urlInfoWanted && !snapshot && !listTree;
+        QVector<FtpDirEntry> entries;
+        QVector<QUrlInfo> batch;
+        QString dir;
+        for (;;) {
+            const char *newline = _q_findNewline(pos, end);
+            if (newline == end)
+                break;
+            FtpDirEntry entry;
+            const QByteArray line = QByteArray::fromRawData(pos, int(newline + 1 - pos));
+            pos = newline + 1;
 #if defined(QFTPDTP_DEBUG)
             qDebug("QFtpDTP read (list): '%s'", line.constData());
 #endif
-            if (parseDir(line, QLatin1String(""), &i)) {
-                emit listInfo(i);
+            if (parseDir(line, QLatin1String(""), &entry, &listStrings)) {
+                if (snapshot) {
+                    snapshot->append(entry);
+                    continue;
+                }
+                if (wantUrlInfo) {
+                    const QUrlInfo i = entry.toUrlInfo();
+                    emit listInfo(i);
+                    batch.append(i);
+                }
+                entries.append(entry);
+                listTreeDirEmpty = false;
+            } else if (listTree && parseTreeHeader(line, &dir)) {
+                // the entries so far belong to the previous directory; an
+                // empty directory is reported with an empty batch
+                if (!entries.isEmpty() || listTreeDirEmpty)
+                    emit listTreeBatch(listTreeDir, entries);
+                entries.clear();
+                listTreeDir = dir;
+                listTreeDirEmpty = true;
             } else {
                 // some FTP servers don't return a 550 if the file or directory
                 // does not exist, but rather write a text to the data socket
@@ -687,7 +1190,16 @@ void QFtpDTP::socketReadyRead()
                 if (line.endsWith("No such file or directory\r\n"))
                     err = QString::fromLatin1(line);
             }
+            if (generation != listGeneration)
+                return;
         }
+        listBuffer = buffer.mid(int(pos - begin));
+        if (!entries.isEmpty() && listTree)
+            emit listTreeBatch(listTreeDir, entries);
+        else if (!entries.isEmpty())
+            emit listEntryBatch(entries);
+        if (!batch.isEmpty())
+            emit listInfoBatch(batch);
     } else {
         if (!is_ba && data.dev) {
             do {
@@ -740,10 +1252,27 @@ void QFtpDTP::socketError(QAbstractSocket::SocketError e)
 
 void QFtpDTP::socketConnectionClosed()
 {
+    stallTimer.stop();
     if (!is_ba && data.dev) {
         clearData();
     }
 
+    if (listParallel) {
+        listBuffer.append(socket->readAll());
+        if (listWatcher.isRunning() || startListParsing()) {
+            // CsClosed is emitted once the pool is done with the listing
+            listClosePending = true;
+            return;
+        }
+        listParallel = false;
+    }
+
+    if (listTree && listTreeDirEmpty) {
+        // the last header of a recursive listing had no entries after it
+        listTreeDirEmpty = false;
+        emit listTreeBatch(listTreeDir, QVector<FtpDirEntry>());
+    }
+
     bytesFromSocket = socket->readAll();
 #if defined(QFTPDTP_DEBUG)
     qDebug("QFtpDTP::connectState(CsClosed)");
@@ -764,6 +1293,7 @@ void QFtpDTP::socketBytesWritten(qint64 bytes)
 
 void QFtpDTP::setupSocket()
 {
+    resetListParsing();
     socket = listener.nextPendingConnection();
     socket->setObjectName(QLatin1String("QFtpDTP Active state socket"));
     connect(socket, SIGNAL(connected()), SLOT(socketConnected()));
@@ -773,6 +1303,7 @@ void QFtpDTP::setupSocket()
     connect(socket, SIGNAL(bytesWritten(qint64)), SLOT(socketBytesWritten(qint64)));
 
     listener.close();
+    startStallCheck();
 }
 
 void QFtpDTP::clearData()
@@ -795,8 +1326,14 @@ QFtpPI::QFtpPI(QObject *parent) :
     state(Begin), abortState(None),
     currentCmd(QString()),
     waitForDtpToConnect(false),
-    waitForDtpToClose(false)
-{
+    waitForDtpToClose(false),
+    fastAbortGrace(-1),
+    abortRepliesPending(0),
+    recovering(false),
+    sessionPort(0)
+{
+    fastAbortTimer.setSingleShot(true);
+    connect(&fastAbortTimer, SIGNAL(timeout()), SLOT(fastAbortTimeout()));
     commandSocket.setObjectName(QLatin1String("QFtpPI_socket"));
     connect(&commandSocket, SIGNAL(hostFound()),
             SLOT(hostFound()));
@@ -821,6 +1358,12 @@ void QFtpPI::connectToHost(const QString &host, quint16 port)
     commandSocket.setProperty("_q_networksession", property("_q_networksession"));
     dtp.setProperty("_q_networksession", property("_q_networksession"));
 #endif
+    sessionHost = host;
+    sessionPort = port;
+    loginCmds.clear();
+    typeCmd.clear();
+    cwdCmds.clear();
+    dtp.clearStringPool();
     commandSocket.connectToHost(host, port);
 }
 
@@ -873,8 +1416,125 @@ void QFtpPI::abort()
         dtp.abortConnection();
 }
 
+/*
+  Aborts the running command without relying on the server: the data
+  connection is dropped at once and ABOR is sent. A clean reply to it
+  emits aborted(); otherwise fastAbortTimeout() replaces the control
+  connection and emits aborted() once the session is restored.
+*/
+void QFtpPI::fastAbort()
+{
+    pendingCommands.clear();
+    dtp.abortConnection();
+    dtp.clearError();
+
+    if (abortState != None)
+        return;
+
+    abortState = AbortStarted;
+    // a completion reply held back until the data connection closes has
+    // already been read; otherwise the running command still answers
+    abortRepliesPending = waitForDtpToClose ? 1 : 2;
+#if defined(QFTPPI_DEBUG)
+    qDebug("QFtpPI send: ABOR (fast)");
+#endif
+    commandSocket.write("ABOR\r\n", 6);
+    fastAbortTimer.start(qMax(0, fastAbortGrace));
+}
+
+/*
+  Reads the replies that follow a fast ABOR. The running command
+  answers first (426, or its 2xx completion if it finished before ABOR
+  arrived), then ABOR itself (225/226). Preliminary 1yz replies and
+  the lines of multi-line replies are skipped. Only once both final
+  replies are in is the abort complete; anything still buffered then
+  belongs to it as well and is dropped, so that the next command does
+  not take it for its own reply.
+*/
+void QFtpPI::readAbortReplies()
+{
+    while (commandSocket.canReadLine()) {
+        const QByteArray line = commandSocket.readLine();
+        if (line.size() < 4 || line.at(3) != ' ')
+            continue; // part of a multi-line reply
+        if (line.at(0) < '2' || line.at(0) > '5')
+            continue; // preliminary reply, or not a reply line at all
+        if (--abortRepliesPending > 0)
+            continue;
+
+        while (commandSocket.canReadLine())
+            commandSocket.readLine();
+        fastAbortTimer.stop();
+        abortState = None;
+        waitForDtpToClose = false;
+        waitForDtpToConnect = false;
+        replyText.clear();
+        currentCmd.clear();
+        state = Idle;
+        emit aborted();
+        return;
+    }
+}
+
+void QFtpPI::fastAbortTimeout()
+{
+#if defined(QFTPPI_DEBUG)
+    qDebug("QFtpPI: no reply to ABOR, reconnecting to %s", sessionHost.toLatin1().constData());
+#endif
+    // The session state is not reported while the connection is
+    // replaced; the QFtp state stays LoggedIn throughout.
+    recovering = true;
+    abortState = None;
+    waitForDtpToClose = false;
+    waitForDtpToConnect = false;
+    replyText.clear();
+    pendingCommands.clear();
+    currentCmd.clear();
+    state = Begin;
+
+    commandSocket.blockSignals(true);
+    commandSocket.abort();
+    commandSocket.blockSignals(false);
+    commandSocket.connectToHost(sessionHost, sessionPort);
+}
+
+/*
+  Records the commands that define the session state, so that a
+  replaced control connection can be brought back to it.
+*/
+void QFtpPI::rememberSessionCommand()
+{
+    if (recovering)
+        return;
+    if (currentCmd.startsWith(QLatin1String("USER "))) {
+        loginCmds = QStringList(currentCmd);
+    } else if (currentCmd.startsWith(QLatin1String("PASS ")) || currentCmd.startsWith(QLatin1String("ACCT "))) {
+        loginCmds.append(currentCmd);
+    } else if (currentCmd.startsWith(QLatin1String("TYPE "))) {
+        typeCmd = currentCmd;
+    } else if (currentCmd.startsWith(QLatin1String("CWD "))) {
+        if (currentCmd.at(4) == QLatin1Char('/'))
+            cwdCmds.clear();
+        cwdCmds.append(currentCmd);
+    } else if (currentCmd.startsWith(QLatin1String("CDUP"))) {
+        cwdCmds.append(currentCmd);
+    }
+}
+
+void QFtpPI::recoveryFailed(int code, const QString &text)
+{
+    recovering = false;
+    commandSocket.blockSignals(true);
+    commandSocket.abort();
+    commandSocket.blockSignals(false);
+    emit connectState(QFtp::Unconnected);
+    emit error(code, text);
+}
+
 void QFtpPI::hostFound()
 {
+    if (recovering)
+        return;
     emit connectState(QFtp::Connecting);
 }
 
@@ -887,12 +1547,18 @@ void QFtpPI::connected()
     // try to improve performance by setting TCP_NODELAY
     commandSocket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
 
+    if (recovering)
+        return;
     emit connectState(QFtp::Connected);
 }
 
 void QFtpPI::connectionClosed()
 {
     commandSocket.close();
+    if (recovering) {
+        recoveryFailed(QFtp::UnknownError, QFtp::tr("Connection closed while reconnecting to host %1").arg(sessionHost));
+        return;
+    }
     emit connectState(QFtp::Unconnected);
 }
 
@@ -903,6 +1569,11 @@ void QFtpPI::delayedCloseFinished()
 
 void QFtpPI::error(QAbstractSocket::SocketError e)
 {
+    if (recovering) {
+        recoveryFailed(QFtp::ConnectionRefused,
+                       QFtp::tr("Reconnecting to host %1 failed: %2").arg(sessionHost, commandSocket.errorString()));
+        return;
+    }
     if (e == QTcpSocket::HostNotFoundError) {
         emit connectState(QFtp::Unconnected);
         emit error(QFtp::HostNotFound,
@@ -920,6 +1591,11 @@ void QFtpPI::error(QAbstractSocket::SocketError e)
 
 void QFtpPI::readyRead()
 {
+    if (abortState != None && fastAbortTimer.isActive()) {
+        readAbortReplies();
+        return;
+    }
+
     if (waitForDtpToClose)
         return;
 
@@ -1021,6 +1697,15 @@ bool QFtpPI::processReply()
                 return true;
             } else if (replyCode[0] == 2) {
                 state = Idle;
+                if (recovering) {
+                    // log in again and restore the type and directory
+                    pendingCommands = loginCmds;
+                    if (!typeCmd.isEmpty())
+                        pendingCommands.append(typeCmd);
+                    pendingCommands += cwdCmds;
+                    startNextCmd();
+                    return true;
+                }
                 emit finished(QFtp::tr("Connected to host %1").arg(commandSocket.peerName()));
                 break;
             }
@@ -1099,11 +1784,19 @@ bool QFtpPI::processReply()
             pendingCommands.pop_front();
         }
         // 230 User logged in, proceed.
-        emit connectState(QFtp::LoggedIn);
+        if (!recovering)
+            emit connectState(QFtp::LoggedIn);
     } else if (replyCodeInt == 213) {
         // 213 File status.
-        if (currentCmd.startsWith(QLatin1String("SIZE ")))
-            dtp.setBytesTotal(replyText.simplified().toLongLong());
+        if (currentCmd.startsWith(QLatin1String("SIZE "))) {
+            qint64 total = replyText.simplified().toLongLong();
+            // a restarted RETR transfers only the rest of the file
+            for (const QString &cmd : qAsConst(pendingCommands)) {
+                if (cmd.startsWith(QLatin1String("REST ")))
+                    total -= cmd.mid(5).trimmed().toLongLong();
+            }
+            dtp.setBytesTotal(qMax<qint64>(0, total));
+        }
     } else if (replyCode[0]==1 && currentCmd.startsWith(QLatin1String("STOR "))) {
         dtp.waitForConnection();
         dtp.writeData();
@@ -1119,6 +1812,7 @@ bool QFtpPI::processReply()
             state = Idle;
             // no break!
         case Idle:
+            rememberSessionCommand();
             if (dtp.hasError()) {
                 emit error(QFtp::UnknownError, dtp.errorMessage());
                 dtp.clearError();
@@ -1137,6 +1831,13 @@ bool QFtpPI::processReply()
             } else if (currentCmd.startsWith(QLatin1String("EPRT"))) {
                 transferConnectionExtended = false;
                 pendingCommands.prepend(QLatin1String("PORT\r\n"));
+            } else if (recovering) {
+                recoveryFailed(QFtp::UnknownError, replyText);
+                return true;
+            } else if (dtp.hasError()) {
+                // e.g. a stalled data connection the DTP dropped
+                emit error(QFtp::UnknownError, dtp.errorMessage());
+                dtp.clearError();
             } else {
                 emit error(QFtp::UnknownError, replyText);
             }
@@ -1168,6 +1869,11 @@ bool QFtpPI::startNextCmd()
 #endif
     if (pendingCommands.isEmpty()) {
         currentCmd.clear();
+        if (recovering) {
+            recovering = false;
+            emit aborted();
+            return false;
+        }
         emit finished(replyText);
         return false;
     }
@@ -1271,6 +1977,7 @@ public:
     void _q_piError(int, const QString&);
     void _q_piConnectState(int);
     void _q_piFtpReply(int, const QString&);
+    void _q_piAborted();
 
     int addCommand(QFtpCommand *cmd);
 
@@ -1416,6 +2123,11 @@ QFtp::QFtp(QObject *parent)
 {
     d->errorString = tr("Unknown error");
 
+    qRegisterMetaType<QUrlInfo>();
+    qRegisterMetaType<QVector<QUrlInfo> >();
+    qRegisterMetaType<FtpDirEntry>();
+    qRegisterMetaType<QVector<FtpDirEntry> >();
+
     connect(&d->pi, SIGNAL(connectState(int)),
             SLOT(_q_piConnectState(int)));
     connect(&d->pi, SIGNAL(finished(QString)),
@@ -1424,6 +2136,8 @@ QFtp::QFtp(QObject *parent)
             SLOT(_q_piError(int,QString)));
     connect(&d->pi, SIGNAL(rawFtpReply(int,QString)),
             SLOT(_q_piFtpReply(int,QString)));
+    connect(&d->pi, SIGNAL(aborted()),
+            SLOT(_q_piAborted()));
 
     connect(&d->pi.dtp, SIGNAL(readyRead()),
             SIGNAL(readyRead()));
@@ -1431,6 +2145,12 @@ QFtp::QFtp(QObject *parent)
             SIGNAL(dataTransferProgress(qint64,qint64)));
     connect(&d->pi.dtp, SIGNAL(listInfo(QUrlInfo)),
             SIGNAL(listInfo(QUrlInfo)));
+    connect(&d->pi.dtp, SIGNAL(listInfoBatch(QVector<QUrlInfo>)),
+            SIGNAL(listInfoBatch(QVector<QUrlInfo>)));
+    connect(&d->pi.dtp, SIGNAL(listEntryBatch(QVector<FtpDirEntry>)),
+            SIGNAL(listEntryBatch(QVector<FtpDirEntry>)));
+    connect(&d->pi.dtp, SIGNAL(listTreeBatch(QString,QVector<FtpDirEntry>)),
+            SIGNAL(listTreeBatch(QString,QVector<FtpDirEntry>)));
 }
 
 /*!
@@ -1545,6 +2265,48 @@ QFtp::QFtp(QObject *parent)
     \sa list()
 */
 
+/*!
+    \fn void QFtp::listInfoBatch(const QVector<QUrlInfo> &infos);
+
+    This signal is emitted by the list() command for every block of
+    data received on the data connection. \a infos holds all directory
+    entries that were parsed from that block, in the order the server
+    sent them.
+
+    The same entries are also reported one by one through listInfo().
+    Connecting to this signal instead is considerably cheaper for
+    large directories, especially over queued connections, where it
+    posts one event per block instead of one per entry.
+
+    \sa listInfo() listEntryBatch() list()
+*/
+
+/*!
+    \fn void QFtp::listEntryBatch(const QVector<FtpDirEntry> &entries);
+
+    This signal is emitted by the list() command for every block of
+    data received on the data connection, with the same entries as
+    listInfoBatch(), but in the compact FtpDirEntry form.
+
+    QUrlInfo objects are only created while listInfo() or
+    listInfoBatch() are connected, so receivers that only need this
+    signal do not pay for them.
+
+    \sa listInfoBatch() list()
+*/
+
+/*!
+    \fn void QFtp::listTreeBatch(const QString &dir, const QVector<FtpDirEntry> &entries);
+
+    This signal is emitted by the listRecursive() command for every
+    block of entries received on the data connection. \a dir is the
+    directory the \a entries belong to; the entries of one directory
+    may arrive in several batches. An empty directory is reported with
+    an empty batch.
+
+    \sa listRecursive()
+*/
+
 /*!
     \fn void QFtp::commandStarted(int id)
 
@@ -1733,7 +2495,8 @@ int QFtp::setProxy(const QString &host, quint16 port)
     Lists the contents of directory \a dir on the FTP server. If \a
     dir is empty, it lists the contents of the current directory.
 
-    The listInfo() signal is emitted for each directory entry found.
+    The listInfo() signal is emitted for each directory entry found,
+    and listInfoBatch() and listEntryBatch() for each block of entries.
 
     The function does not block and returns immediately. The command
     is scheduled, and its execution is performed asynchronously. The
@@ -1744,9 +2507,96 @@ int QFtp::setProxy(const QString &host, quint16 port)
     emitted. When it is finished the commandFinished() signal is
     emitted.
 
-    \sa listInfo() commandStarted() commandFinished()
+    \sa listInfo() listInfoBatch() commandStarted() commandFinished()
 */
 int QFtp::list(const QString &dir)
+{
+    return list(dir, 0);
+}
+
+/*!
+    \overload
+
+    Lists the contents of directory \a dir into \a snapshot. The parsed
+    entries are appended to \a snapshot as they arrive, and none of the
+    listing signals are emitted for this command.
+
+    Make sure that the \a snapshot pointer is valid for the duration of
+    the operation (it is safe to delete it when the commandFinished()
+    signal is emitted).
+
+    \sa FtpDirSnapshot
+*/
+int QFtp::list(const QString &dir, FtpDirSnapshot *snapshot)
+{
+    QStringList cmds;
+    cmds << QLatin1String("TYPE A\r\n");
+    cmds << QLatin1String(d->transferMode == Passive ? "PASV\r\n" : "PORT\r\n");
+    if (dir.isEmpty())
+        cmds << QLatin1String("LIST\r\n");
+    else
+        cmds << (QLatin1String("LIST ") + dir + QLatin1String("\r\n"));
+    QFtpCommand *c = new QFtpCommand(List, cmds);
+    c->snapshot = snapshot;
+    return d->addCommand(c);
+}
+
+/*!
+    Lists the whole tree below \a dir with a single \c{LIST -R}
+    command. If \a dir is empty, the current directory is listed.
+
+    Servers such as vsftpd and ProFTPD answer with one listing that
+    contains a \c{path:} header before the entries of each directory.
+    The listing is parsed as it arrives, and the entries are reported
+    through listTreeBatch() together with the directory they belong to;
+    listInfo(), listInfoBatch() and listEntryBatch() are not emitted.
+    Paths are reported as the server prints them, with relative headers
+    resolved against \a dir.
+
+    Servers that do not support the option either fail the command or
+    ignore it and list \a dir alone, in which case all entries are
+    reported for \a dir and its subdirectories have to be listed
+    separately.
+
+    The function does not block and returns immediately. The command
+    is scheduled, and its execution is performed asynchronously. The
+    function returns a unique identifier which is passed by
+    commandStarted() and commandFinished(). currentCommand() reports
+    it as List.
+
+    \sa list() listTreeBatch()
+*/
+int QFtp::listRecursive(const QString &dir)
+{
+    QStringList cmds;
+    cmds << QLatin1String("TYPE A\r\n");
+    cmds << QLatin1String(d->transferMode == Passive ? "PASV\r\n" : "PORT\r\n");
+    if (dir.isEmpty())
+        cmds << QLatin1String("LIST -R\r\n");
+    else
+        cmds << (QLatin1String("LIST -R ") + dir + QLatin1String("\r\n"));
+    QFtpCommand *c = new QFtpCommand(List, cmds);
+    c->tree = true;
+    c->treeRoot = dir;
+    return d->addCommand(c);
+}
+
+/*!
+    \overload
+
+    Lists the contents of directory \a dir and writes the listing, as
+    sent by the server, to the device \a dev. Nothing is parsed and
+    none of the listing signals are emitted; dataTransferProgress() is
+    emitted as the data arrives. Use parseDirEntry() to parse lines of
+    the listing.
+
+    Make sure that the \a dev pointer is valid for the duration of the
+    operation (it is safe to delete it when the commandFinished()
+    signal is emitted).
+
+    \sa list() parseDirEntry()
+*/
+int QFtp::listRaw(const QString &dir, QIODevice *dev)
 {
     QStringList cmds;
     cmds << QLatin1String("TYPE A\r\n");
@@ -1755,7 +2605,19 @@ int QFtp::list(const QString &dir)
         cmds << QLatin1String("LIST\r\n");
     else
         cmds << (QLatin1String("LIST ") + dir + QLatin1String("\r\n"));
-    return d->addCommand(new QFtpCommand(List, cmds));
+    return d->addCommand(new QFtpCommand(List, cmds, dev));
+}
+
+/*!
+    Parses one \a line of a directory listing, in the Unix or DOS
+    formats understood by list(), into \a entry. Returns false if the
+    line is not a directory entry, for example a "total" line.
+
+    \sa listRaw()
+*/
+bool QFtp::parseDirEntry(const QByteArray &line, FtpDirEntry *entry)
+{
+    return QFtpDTP::parseDir(line, QLatin1String(""), entry);
 }
 
 /*!
@@ -1805,6 +2667,12 @@ int QFtp::cd(const QString &dir)
     The data is transferred as Binary or Ascii depending on the value
     of \a type.
 
+    If \a offset is greater than 0, the download starts at that byte
+    of the file (\c REST before \c RETR); dataTransferProgress() then
+    counts only the remaining bytes. Servers that do not support
+    restarting make the command fail. To read only a part of the file,
+    call abort() once enough data has arrived.
+
     The function does not block and returns immediately. The command
     is scheduled, and its execution is performed asynchronously. The
     function returns a unique identifier which is passed by
@@ -1817,7 +2685,7 @@ int QFtp::cd(const QString &dir)
     \sa readyRead() dataTransferProgress() commandStarted()
     commandFinished()
 */
-int QFtp::get(const QString &file, QIODevice *dev, TransferType type)
+int QFtp::get(const QString &file, QIODevice *dev, TransferType type, qint64 offset)
 {
     QStringList cmds;
     if (type == Binary)
@@ -1826,6 +2694,8 @@ int QFtp::get(const QString &file, QIODevice *dev, TransferType type)
         cmds << QLatin1String("TYPE A\r\n");
     cmds << QLatin1String("SIZE ") + file + QLatin1String("\r\n");
     cmds << QLatin1String(d->transferMode == Passive ? "PASV\r\n" : "PORT\r\n");
+    if (offset > 0)
+        cmds << QLatin1String("REST ") + QString::number(offset) + QLatin1String("\r\n");
     cmds << QLatin1String("RETR ") + file + QLatin1String("\r\n");
     return d->addCommand(new QFtpCommand(Get, cmds, dev));
 }
@@ -1998,6 +2868,109 @@ int QFtp::rawCommand(const QString &command)
     return d->addCommand(new QFtpCommand(RawCommand, QStringList(cmd)));
 }
 
+/*!
+    Makes list() parse listings larger than \a bytes on the global
+    thread pool. Once that many bytes of a listing have arrived, the rest
+    of it is collected, split at line boundaries and parsed concurrently.
+    The listInfo() and listInfoBatch() signals are still emitted in the
+    order in which the server sent the entries, and the command does not
+    finish before all of them have been emitted.
+
+    Smaller listings are parsed as they arrive, so they keep their
+    latency. A value of 0, which is the default, disables parallel
+    parsing.
+
+    \sa listParseThreshold() list()
+*/
+void QFtp::setListParseThreshold(qint64 bytes)
+{
+    d->pi.dtp.setListParseThreshold(bytes);
+}
+
+/*!
+    Returns the listing size above which list() parses on the thread
+    pool, or 0 if parallel parsing is disabled.
+
+    \sa setListParseThreshold()
+*/
+qint64 QFtp::listParseThreshold() const
+{
+    return d->pi.dtp.listParseThreshold();
+}
+
+/*!
+    Enables detection of stalled transfers. While a data connection is
+    open, its transfer rate is sampled several times per \a windowMsecs
+    and smoothed. Once the average stays below \a minBytesPerSecond
+    for \a windowMsecs milliseconds, the data connection is aborted.
+    The running command then finishes with an error, as soon as the
+    server acknowledges the closed connection. The control connection
+    and the login are kept.
+
+    The rate includes data that arrived but was not read yet with
+    read() or readAll(), so a slow reader does not count as a stall.
+    A \a minBytesPerSecond of 0, which is the default, disables the
+    detection.
+
+    \sa stallRateFloor() stallWindow()
+*/
+void QFtp::setStallDetection(qint64 minBytesPerSecond, int windowMsecs)
+{
+    d->pi.dtp.setStallDetection(minBytesPerSecond, windowMsecs);
+}
+
+/*!
+    Returns the transfer rate in bytes per second below which a data
+    connection counts as stalled, or 0 if stall detection is disabled.
+
+    \sa setStallDetection()
+*/
+qint64 QFtp::stallRateFloor() const
+{
+    return d->pi.dtp.stallRateFloor();
+}
+
+/*!
+    Returns how long in milliseconds a transfer may stay below
+    stallRateFloor() before it is aborted.
+
+    \sa setStallDetection()
+*/
+int QFtp::stallWindow() const
+{
+    return d->pi.dtp.stallWindow();
+}
+
+/*!
+    Returns true if the data connection of the last transfer was
+    aborted because it stalled. The flag is cleared when the next data
+    connection opens.
+
+    \sa setStallDetection()
+*/
+bool QFtp::hasStalled() const
+{
+    return d->pi.dtp.hasStalled();
+}
+
+/*!
+    \reimp
+*/
+void QFtp::connectNotify(const QMetaMethod &signal)
+{
+    Q_UNUSED(signal);
+    d->pi.dtp.setUrlInfoWanted(isSignalConnected(QMetaMethod::fromSignal(&QFtp::listInfo))
+                               || isSignalConnected(QMetaMethod::fromSignal(&QFtp::listInfoBatch)));
+}
+
+/*!
+    \reimp
+*/
+void QFtp::disconnectNotify(const QMetaMethod &signal)
+{
+    connectNotify(signal);
+}
+
 /*!
     Returns the number of bytes that can be read from the data socket
     at the moment.
@@ -2063,17 +3036,60 @@ QByteArray QFtp::readAll()
     error flag set to \c false, even though the command did not
     complete successfully.
 
-    \sa clearPendingCommands()
+    With setFastAbort() enabled the data connection is dropped at once
+    and the server is given a short grace period to confirm the abort.
+    If it does not, the control connection is replaced: a new one is
+    opened, logged in and brought back to the same transfer type and
+    working directory, without any stateChanged() signals. In both
+    cases the aborted command finishes with \c error set to \c true.
+    Unlike a normal abort, the scheduled commands are kept and run
+    afterwards as usual; call clearPendingCommands() first to drop
+    them. While connecting or logging in, or before the command has
+    been sent to the server, abort() works as without fast aborting.
+
+    \sa clearPendingCommands() setFastAbort()
 */
 void QFtp::abort()
 {
     if (d->pending.isEmpty())
         return;
 
+    // a fast abort restores the session, so the queued commands can
+    // still run; it needs a command on the wire in a logged in session
+    if (d->pi.fastAbortGracePeriod() >= 0 && !d->pi.currentCommand().isEmpty()
+            && d->state == LoggedIn) {
+        d->pi.fastAbort();
+        return;
+    }
     clearPendingCommands();
     d->pi.abort();
 }
 
+/*!
+    Enables fast aborting if \a enable is true. abort() then waits at
+    most \a graceMsecs milliseconds for the server to confirm the
+    abort before it replaces the control connection. Servers that never
+    answer \c ABOR properly can otherwise leave the session hanging.
+
+    Fast aborting is disabled by default.
+
+    \sa abort() isFastAbort()
+*/
+void QFtp::setFastAbort(bool enable, int graceMsecs)
+{
+    d->pi.setFastAbortGrace(enable ? qMax(0, graceMsecs) : -1);
+}
+
+/*!
+    Returns true if abort() uses fast aborting.
+
+    \sa setFastAbort()
+*/
+bool QFtp::isFastAbort() const
+{
+    return d->pi.fastAbortGracePeriod() >= 0;
+}
+
 /*!
     Returns the identifier of the FTP command that is being executed
     or 0 if there is no command being executed.
@@ -2234,6 +3250,8 @@ void QFtpPrivate::_q_startNextCommand()
             pi.connectToHost(c->rawCmds[0], c->rawCmds[1].toUInt());
         }
     } else {
+        pi.dtp.setSnapshot(c->snapshot);
+        pi.dtp.setListTree(c->tree, c->treeRoot);
         if (c->command == QFtp::Put) {
             if (c->is_ba) {
                 pi.dtp.setData(c->data.ba);
@@ -2252,6 +3270,11 @@ void QFtpPrivate::_q_startNextCommand()
             if (!c->is_ba && c->data.dev) {
                 pi.dtp.setDevice(c->data.dev);
             }
+        } else if (c->command == QFtp::List) {
+            // a device is only set by listRaw()
+            pi.dtp.setDevice(c->data.dev);
+            if (c->data.dev)
+                pi.dtp.setBytesTotal(0);
         } else if (c->command == QFtp::Close) {
             state = QFtp::Closing;
             emit q->stateChanged(state);
@@ -2371,6 +3394,8 @@ void QFtpPrivate::_q_piError(int errorCode, const QString &text)
 void QFtpPrivate::_q_piConnectState(int connectState)
 {
     state = QFtp::State(connectState);
+    if (state == QFtp::Unconnected)
+        pi.dtp.clearStringPool();
     emit q_func()->stateChanged(state);
     if (close_waitForStateChange) {
         close_waitForStateChange = false;
@@ -2388,6 +3413,27 @@ void QFtpPrivate::_q_piFtpReply(int code, const QString &text)
     }
 }
 
+/*! \internal
+*/
+void QFtpPrivate::_q_piAborted()
+{
+    Q_Q(QFtp);
+    if (pending.isEmpty())
+        return;
+    QFtpCommand *c = pending.first();
+
+    error = QFtp::UnknownError;
+    errorString = QFtp::tr("Aborted");
+    emit q->commandFinished(c->id, true);
+
+    pending.removeFirst();
+    delete c;
+    if (pending.isEmpty())
+        emit q->done(true);
+    else
+        _q_startNextCommand();
+}
+
 /*!
     Destructor.
 */
@@ -44,7 +44,11 @@
 
 #include <QtCore/qstring.h>
 #include <QtCore/qobject.h>
+#include <QtCore/qvector.h>
 #include <qurlinfo.h>
+#include <ftpdirentry.h>
+
+class FtpDirSnapshot;
 
 QT_BEGIN_NAMESPACE
 
@@ -110,8 +114,11 @@ public:
     int close();
     int setTransferMode(TransferMode mode);
     int list(const QString &dir = QString());
+    int list(const QString &dir, FtpDirSnapshot *snapshot);
+    int listRecursive(const QString &dir = QString());
+    int listRaw(const QString &dir, QIODevice *dev);
     int cd(const QString &dir);
-    int get(const QString &file, QIODevice *dev=0, TransferType type = Binary);
+    int get(const QString &file, QIODevice *dev=0, TransferType type = Binary, qint64 offset = 0);
     int put(const QByteArray &data, const QString &file, TransferType type = Binary);
     int put(QIODevice *dev, const QString &file, TransferType type = Binary);
     int remove(const QString &file);
@@ -121,6 +128,19 @@ public:
 
     int rawCommand(const QString &command);
 
+    static bool parseDirEntry(const QByteArray &line, FtpDirEntry *entry);
+
+    void setListParseThreshold(qint64 bytes);
+    qint64 listParseThreshold() const;
+
+    void setStallDetection(qint64 minBytesPerSecond, int windowMsecs);
+    qint64 stallRateFloor() const;
+    int stallWindow() const;
+    bool hasStalled() const;
+
+    void setFastAbort(bool enable, int graceMsecs = 2000);
+    bool isFastAbort() const;
+
     qint64 bytesAvailable() const;
     qint64 read(char *data, qint64 maxlen);
     QByteArray readAll();
@@ -142,6 +162,9 @@ public Q_SLOTS:
 Q_SIGNALS:
     void stateChanged(State);
     void listInfo(const QUrlInfo&);
+    void listInfoBatch(const QVector<QUrlInfo>&);
+    void listEntryBatch(const QVector<FtpDirEntry>&);
+    void listTreeBatch(const QString&, const QVector<FtpDirEntry>&);
     void readyRead();
     void dataTransferProgress(qint64, qint64);
     void rawCommandReply(int, const QString&);
@@ -150,6 +173,10 @@ Q_SIGNALS:
     void commandFinished(int, bool);
     void done(bool);
 
+protected:
+    void connectNotify(const QMetaMethod &signal) override;
+    void disconnectNotify(const QMetaMethod &signal) override;
+
 private:
     Q_DISABLE_COPY(QFtp)
     QScopedPointer<QFtpPrivate> d;
@@ -159,6 +186,7 @@ private:
     Q_PRIVATE_SLOT(d, void _q_piError(int, const QString&))
     Q_PRIVATE_SLOT(d, void _q_piConnectState(int))
     Q_PRIVATE_SLOT(d, void _q_piFtpReply(int, const QString&))
+    Q_PRIVATE_SLOT(d, void _q_piAborted())
 };
 
 QT_END_NAMESPACE
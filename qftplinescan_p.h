@@ -0,0 +1,59 @@
+#ifndef QFTPLINESCAN_P_H
+#define QFTPLINESCAN_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the public API. It is shared by qftp.cpp
+// and the listing benchmark and may change without notice.
+//
+
+#include <QtCore/qalgorithms.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define QFTP_SSE2
+#  include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#  define QFTP_AVX2
+#  include <immintrin.h>
+#endif
+
+QT_BEGIN_NAMESPACE
+
+/*
+  Returns a pointer to the first '\n' in [p, end), or end if there is
+  none. Listings are scanned 32 or 16 bytes at a time where the target
+  has AVX2 or SSE2; other targets use the plain loop.
+*/
+static inline const char *_q_findNewline(const char *p, const char *end)
+{
+#if defined(QFTP_AVX2)
+    const __m256i newline32 = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const quint32 mask = quint32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline32)));
+        if (mask)
+            return p + qCountTrailingZeroBits(mask);
+    }
+#endif
+#if defined(QFTP_SSE2)
+    const __m128i newline16 = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const quint32 mask = quint32(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline16)));
+        if (mask)
+            return p + qCountTrailingZeroBits(mask);
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == '\n')
+            return p;
+    }
+    return end;
+}
+
+QT_END_NAMESPACE
+
+#endif // QFTPLINESCAN_P_H
@@ -47,7 +47,7 @@
 
 QT_BEGIN_NAMESPACE
 
-class QUrlInfoPrivate
+class QUrlInfoPrivate : public QSharedData
 {
 public:
     QUrlInfoPrivate() :
@@ -99,6 +99,10 @@ public:
     if you call setWritable(true) on a read-only resource the only
     thing changed is the QUrlInfo object, not the resource.
 
+    QUrlInfo is implicitly shared: copying it only increments a
+    reference count, and the data is detached when one of the copies
+    is modified.
+
     \sa QUrl, {FTP Example}
 */
 
@@ -127,23 +131,37 @@ public:
 
 QUrlInfo::QUrlInfo()
 {
-    d = 0;
 }
 
 /*!
     Copy constructor, copies \a ui to this URL info object.
+
+    This operation takes constant time, because QUrlInfo is implicitly
+    shared.
 */
 
 QUrlInfo::QUrlInfo(const QUrlInfo &ui)
+    : d(ui.d)
 {
-    if (ui.d) {
-        d = new QUrlInfoPrivate;
-        *d = *ui.d;
-    } else {
-        d = 0;
-    }
 }
 
+/*!
+    Move-constructs a QUrlInfo instance, making it point at the same
+    object that \a other was pointing to. \a other is left invalid.
+*/
+
+QUrlInfo::QUrlInfo(QUrlInfo &&other) noexcept
+    : d(std::move(other.d))
+{
+}
+
+/*!
+    \fn void QUrlInfo::swap(QUrlInfo &other)
+
+    Swaps this URL info with \a other. This operation is very fast and
+    never fails.
+*/
+
 /*!
     Constructs a QUrlInfo object by specifying all the URL's
     information.
@@ -160,8 +178,8 @@ QUrlInfo::QUrlInfo(const QString &name, int permissions, const QString &owner,
                     const QString &group, qint64 size, const QDateTime &lastModified,
                     const QDateTime &lastRead, bool isDir, bool isFile, bool isSymLink,
                     bool isWritable, bool isReadable, bool isExecutable)
+    : d(new QUrlInfoPrivate)
 {
-    d = new QUrlInfoPrivate;
     d->name = name;
     d->permissions = permissions;
     d->owner = owner;
@@ -194,8 +212,8 @@ QUrlInfo::QUrlInfo(const QUrl &url, int permissions, const QString &owner,
                     const QString &group, qint64 size, const QDateTime &lastModified,
                     const QDateTime &lastRead, bool isDir, bool isFile, bool isSymLink,
                     bool isWritable, bool isReadable, bool isExecutable)
+    : d(new QUrlInfoPrivate)
 {
-    d = new QUrlInfoPrivate;
     d->name = QFileInfo(url.path()).fileName();
     d->permissions = permissions;
     d->owner = owner;
@@ -429,7 +447,6 @@ void QUrlInfo::setLastRead(const QDateTime &dt)
 
 QUrlInfo::~QUrlInfo()
 {
-    delete d;
 }
 
 /*!
@@ -438,14 +455,19 @@ QUrlInfo::~QUrlInfo()
 
 QUrlInfo &QUrlInfo::operator=(const QUrlInfo &ui)
 {
-    if (ui.d) {
-        if (!d)
-            d= new QUrlInfoPrivate;
-        *d = *ui.d;
-    } else {
-        delete d;
-        d = 0;
-    }
+    d = ui.d;
+    return *this;
+}
+
+/*!
+    Move-assigns \a other to this QUrlInfo instance. \a other is left
+    invalid.
+*/
+
+QUrlInfo &QUrlInfo::operator=(QUrlInfo &&other) noexcept
+{
+    QUrlInfo moved(std::move(other));
+    swap(moved);
     return *this;
 }
 
@@ -684,7 +706,7 @@ bool QUrlInfo::equal(const QUrlInfo &i1, const QUrlInfo &i2,
 bool QUrlInfo::operator==(const QUrlInfo &other) const
 {
     if (!d)
-        return other.d == 0;
+        return !other.d;
     if (!other.d)
         return false;
 
@@ -722,7 +744,7 @@ bool QUrlInfo::operator==(const QUrlInfo &other) const
 */
 bool QUrlInfo::isValid() const
 {
-    return d != 0;
+    return d.constData() != 0;
 }
 
 QT_END_NAMESPACE
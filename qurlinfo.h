@@ -45,6 +45,8 @@
 #include <QtCore/qdatetime.h>
 #include <QtCore/qstring.h>
 #include <QtCore/qiodevice.h>
+#include <QtCore/qmetatype.h>
+#include <QtCore/qshareddata.h>
 
 QT_BEGIN_NAMESPACE
 
@@ -70,8 +72,12 @@ public:
              const QDateTime &lastRead, bool isDir, bool isFile, bool isSymLink,
              bool isWritable, bool isReadable, bool isExecutable);
     QUrlInfo &operator=(const QUrlInfo &ui);
+    QUrlInfo(QUrlInfo &&other) noexcept;
+    QUrlInfo &operator=(QUrlInfo &&other) noexcept;
     virtual ~QUrlInfo();
 
+    void swap(QUrlInfo &other) noexcept { d.swap(other.d); }
+
     virtual void setName(const QString &name);
     virtual void setDir(bool b);
     virtual void setFile(bool b);
@@ -113,9 +119,16 @@ public:
     { return !operator==(i); }
 
 private:
-    QUrlInfoPrivate *d;
+    QSharedDataPointer<QUrlInfoPrivate> d;
 };
 
+// Not Q_DECLARE_SHARED: QUrlInfo has virtual functions, so it is not
+// declared Q_MOVABLE_TYPE and containers relocate it by moving.
+inline void swap(QUrlInfo &value1, QUrlInfo &value2) noexcept
+{ value1.swap(value2); }
+
 QT_END_NAMESPACE
 
+Q_DECLARE_METATYPE(QUrlInfo)
+
 #endif // QURLINFO_H